@@ -0,0 +1,394 @@
+#include "chunker.h"
+#include "callback-sink.h"
+#include "workload.h"
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/*
+ * Chunks a synthetic speech-and-silence workload and prints the results as a
+ * single JSON object, so runs can be compared between releases.
+ */
+
+static int rate = 16000;
+static int length = 60;
+static int chunk_rate = 16000;
+static char *mode = "file";
+static char *muxer = "wavenc";
+static int encoders = 1;
+static char *detector = "energy";
+static int seed = 42;
+static gboolean checkpoint = FALSE;
+
+static GMainLoop *loop = NULL;
+
+/* Chunks checked as WAV files, only touched by the thread getting them. */
+static guint64 wav_time = 0;
+static guint wav_errors = 0;
+
+static GOptionEntry entries[] =
+{
+  { "rate", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &rate,
+    "The sample rate of the generated workload (default: 16000)", "R" },
+  { "length", 'l', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &length,
+    "The length of the generated workload in seconds (default: 60)", "L" },
+  { "chunk-rate", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &chunk_rate,
+    "The sample rate of chunked audio (default: 16000)", "C" },
+  { "mode", 'o', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &mode,
+    "Where the chunks go: \"file\" (default), \"callback\", \"memory\" or \"queue\"", "O" },
+  { "muxer", 'm', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &muxer,
+    "The muxer to encode chunks like \"wavenc\" (default)", "M" },
+  { "encoders", 'e', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &encoders,
+    "The number of threads encoding file chunks; 0 for one per processor (default: 1)", "E" },
+  { "detector", 'd', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &detector,
+    "The detector of pauses: \"energy\" (default) or \"spectral\"", "D" },
+  { "seed", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &seed,
+    "The seed of the generated workload (default: 42)", "S" },
+  { "checkpoint", 'k', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &checkpoint,
+    "Stop after a few file chunks and check the checkpoint against them", NULL },
+  G_OPTION_ENTRY_NULL,
+};
+
+
+/* Chunks to write before stopping with --checkpoint. */
+#define CHECKPOINT_CHUNKS 5
+
+
+static gboolean
+check_done (gpointer user_data)
+{
+  MarsChunker *chunker = MARS_CHUNKER (user_data);
+  g_autoptr (GstStructure) stats = NULL;
+  guint64 chunks = 0;
+
+  if (checkpoint && mars_chunker_is_playing (chunker)) {
+    stats = mars_chunker_get_stats (chunker);
+    gst_structure_get_uint64 (stats, "chunks", &chunks);
+
+    if (chunks >= CHECKPOINT_CHUNKS)
+      mars_chunker_stop (chunker);
+  }
+
+  if (mars_chunker_is_playing (chunker))
+    return G_SOURCE_CONTINUE;
+
+  g_main_loop_quit (loop);
+  return G_SOURCE_REMOVE;
+}
+
+
+static guint32
+read_le32 (const guint8 *data)
+{
+  return data[0] | data[1] << 8 | data[2] << 16 | (guint32) data[3] << 24;
+}
+
+
+/*
+ * Reads a chunk as a whole WAV file. The sizes in the header must match the
+ * chunk, which fails if the header rewritten by wavenc is not at the start.
+ */
+static gboolean
+check_wav (const guint8 *data, gsize size, guint64 *duration)
+{
+  guint32 rate = 0;
+  guint32 frame_size = 0;
+  gsize offset = 12;
+
+  if (size < 12 || memcmp (data, "RIFF", 4) != 0 || memcmp (data + 8, "WAVE", 4) != 0 ||
+      read_le32 (data + 4) != size - 8)
+    return FALSE;
+
+  while (offset + 8 <= size) {
+    guint32 chunk_size = read_le32 (data + offset + 4);
+
+    if (memcmp (data + offset, "fmt ", 4) == 0 && chunk_size >= 16 && offset + 24 <= size) {
+      rate = read_le32 (data + offset + 12);
+      frame_size = data[offset + 20] | data[offset + 21] << 8;
+    } else if (memcmp (data + offset, "data", 4) == 0) {
+      if (rate == 0 || frame_size == 0 || chunk_size != size - offset - 8)
+        return FALSE;
+
+      *duration = gst_util_uint64_scale (chunk_size / frame_size, GST_SECOND, rate);
+      return TRUE;
+    }
+
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  return FALSE;
+}
+
+
+static void
+count_wav (const guint8 *data, gsize size)
+{
+  guint64 duration;
+
+  if (check_wav (data, size, &duration))
+    wav_time += duration;
+  else
+    wav_errors++;
+}
+
+
+static void
+on_chunk_ready (MarsChunker *chunker, GBytes *bytes)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data (bytes, &size);
+
+  count_wav (data, size);
+}
+
+
+/* Joins the buffers of every pulled chunk, which must give the file. */
+static gpointer
+pull_chunks (MarsChunker *chunker)
+{
+  GstBufferList *chunk;
+
+  while ((chunk = mars_chunker_next_chunk (chunker, NULL, NULL)) != NULL) {
+    gsize size = gst_buffer_list_calculate_size (chunk);
+    g_autofree guint8 *data = g_malloc (size);
+    gsize offset = 0;
+
+    for (guint i = 0; i < gst_buffer_list_length (chunk); i++)
+      offset += gst_buffer_extract (gst_buffer_list_get (chunk, i), 0,
+                                    data + offset, size - offset);
+
+    count_wav (data, size);
+    gst_buffer_list_unref (chunk);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Every chunk must be a valid WAV file, and together they must be as long as
+ * the input left after dropping silence.
+ */
+static gboolean
+verify_wav_chunks (GstStructure *stats, guint64 chunks)
+{
+  guint64 input_time = 0;
+  guint64 squashed_time = 0;
+  guint64 expected;
+  guint64 tolerance;
+
+  gst_structure_get_uint64 (stats, "input-time", &input_time);
+  gst_structure_get_uint64 (stats, "silence-squashed-time", &squashed_time);
+  expected = input_time - squashed_time;
+  tolerance = expected / 1000 + (chunks + 1) * 10 * GST_MSECOND;
+
+  if (wav_errors != 0) {
+    g_printerr ("Error: %u chunks are not valid WAV files\n", wav_errors);
+    return FALSE;
+  }
+
+  if (wav_time + tolerance < expected || wav_time > expected + tolerance) {
+    g_printerr ("Error: Chunks last %" GST_TIME_FORMAT " instead of %" GST_TIME_FORMAT "\n",
+                GST_TIME_ARGS (wav_time), GST_TIME_ARGS (expected));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/*
+ * The checkpoint must name a chunk that was written, with an input position
+ * after its start that lies within the workload.
+ */
+static gboolean
+verify_checkpoint (const char *path, const char *output)
+{
+  g_autoptr (GKeyFile) key_file = g_key_file_new ();
+  g_autoptr (GError) error = NULL;
+  g_autofree char *location = NULL;
+  guint64 index;
+  guint64 position = 0;
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error)) {
+    g_printerr ("Error: Unable to load checkpoint: %s\n", error->message);
+    return FALSE;
+  }
+
+  index = g_key_file_get_uint64 (key_file, "Checkpoint", "index", &error);
+
+  if (error == NULL)
+    position = g_key_file_get_uint64 (key_file, "Checkpoint", "position", &error);
+
+  if (error != NULL) {
+    g_printerr ("Error: Unable to read checkpoint: %s\n", error->message);
+    return FALSE;
+  }
+
+  location = g_strdup_printf (output, (guint) index);
+
+  if (!g_file_test (location, G_FILE_TEST_IS_REGULAR)) {
+    g_printerr ("Error: Checkpoint names chunk %" G_GUINT64_FORMAT " that was not written\n", index);
+    return FALSE;
+  }
+
+  if (position == 0 || position > (guint64) length * GST_SECOND) {
+    g_printerr ("Error: Checkpoint position %" GST_TIME_FORMAT " is outside the input\n",
+                GST_TIME_ARGS (position));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context;
+  g_autoptr (MarsChunker) chunker = NULL;
+  g_autoptr (GstStructure) stats = NULL;
+  g_autofree char *dir = NULL;
+  g_autofree char *input = NULL;
+  g_autofree char *output = NULL;
+  g_autofree char *checkpoint_path = NULL;
+  g_autoptr (GEnumClass) detectors = NULL;
+  GEnumValue *detector_value;
+  GThread *consumer = NULL;
+  gboolean checked;
+  struct rusage usage;
+  gint64 begin;
+  gdouble seconds;
+  gdouble real_time_factor;
+  guint64 chunks;
+
+  context = g_option_context_new ("Benchmark chunking of a synthetic workload");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("Error: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  gst_init (&argc, &argv);
+
+  detectors = g_type_class_ref (MARS_TYPE_CHUNKER_DETECTOR);
+  detector_value = g_enum_get_value_by_nick (detectors, detector);
+
+  if (detector_value == NULL) {
+    g_printerr ("Error: Unknown detector %s\n", detector);
+    return EXIT_FAILURE;
+  }
+
+  dir = g_dir_make_tmp ("mars-bench-XXXXXX", &error);
+
+  if (dir == NULL) {
+    g_printerr ("Error: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  input = g_build_filename (dir, "input.wav", NULL);
+  output = g_build_filename (dir, "%05d.chunk", NULL);
+  checkpoint_path = checkpoint ? g_build_filename (dir, "checkpoint", NULL) : NULL;
+
+  checked = g_strcmp0 (mode, "memory") == 0 || g_strcmp0 (mode, "queue") == 0;
+
+  if (checked && g_strcmp0 (muxer, "wavenc") != 0) {
+    g_printerr ("Error: Chunks in memory are checked as WAV files and need wavenc\n");
+    workload_remove_directory (dir);
+    return EXIT_FAILURE;
+  }
+
+  if (checkpoint && g_strcmp0 (mode, "file") != 0) {
+    g_printerr ("Error: Checkpoints need the file mode\n");
+    workload_remove_directory (dir);
+    return EXIT_FAILURE;
+  }
+
+  if (!workload_write_wav (input, seed, rate, (guint64) rate * length)) {
+    g_printerr ("Error: Unable to write %s\n", input);
+    workload_remove_directory (dir);
+    return EXIT_FAILURE;
+  }
+
+  if (g_strcmp0 (mode, "callback") == 0) {
+    chunker = g_object_new (MARS_TYPE_CHUNKER,
+                            "input", input,
+                            "sink", mars_callback_sink_new (),
+                            "muxer", muxer,
+                            "detector", detector_value->value,
+                            "rate", chunk_rate,
+                            NULL);
+  } else if (g_strcmp0 (mode, "memory") == 0) {
+    chunker = g_object_new (MARS_TYPE_CHUNKER,
+                            "input", input,
+                            "in-memory", TRUE,
+                            "muxer", muxer,
+                            "detector", detector_value->value,
+                            "rate", chunk_rate,
+                            NULL);
+    g_signal_connect (chunker, "chunk-ready", G_CALLBACK (on_chunk_ready), NULL);
+  } else if (g_strcmp0 (mode, "queue") == 0) {
+    chunker = g_object_new (MARS_TYPE_CHUNKER,
+                            "input", input,
+                            "max-queued-chunks", 4,
+                            "muxer", muxer,
+                            "detector", detector_value->value,
+                            "rate", chunk_rate,
+                            NULL);
+  } else {
+    chunker = g_object_new (MARS_TYPE_CHUNKER,
+                            "input", input,
+                            "output", output,
+                            "muxer", muxer,
+                            "encoders", encoders,
+                            "detector", detector_value->value,
+                            "rate", chunk_rate,
+                            "checkpoint", checkpoint_path,
+                            NULL);
+  }
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  begin = g_get_monotonic_time ();
+  mars_chunker_play (chunker);
+
+  if (g_strcmp0 (mode, "queue") == 0)
+    consumer = g_thread_new ("consumer", (GThreadFunc) pull_chunks, chunker);
+
+  g_timeout_add (10, check_done, chunker);
+  g_main_loop_run (loop);
+
+  if (consumer != NULL)
+    g_thread_join (consumer);
+  seconds = (gdouble) (g_get_monotonic_time () - begin) / G_USEC_PER_SEC;
+
+  stats = mars_chunker_get_stats (chunker);
+  gst_structure_get_double (stats, "real-time-factor", &real_time_factor);
+  gst_structure_get_uint64 (stats, "chunks", &chunks);
+  getrusage (RUSAGE_SELF, &usage);
+
+  printf ("{\"rate\": %d, \"length\": %d, \"mode\": \"%s\", \"muxer\": \"%s\", \"encoders\": %d, \"detector\": \"%s\", "
+          "\"seconds\": %.3f, \"real-time-factor\": %.6f, \"chunks\": %" G_GUINT64_FORMAT ", "
+          "\"chunks-per-second\": %.3f, \"peak-rss-kb\": %ld}\n",
+          rate, length, mode, muxer, encoders, detector,
+          seconds, real_time_factor, chunks,
+          seconds > 0 ? chunks / seconds : 0, usage.ru_maxrss);
+
+  if ((checked && !verify_wav_chunks (stats, chunks)) ||
+      (checkpoint && !verify_checkpoint (checkpoint_path, output))) {
+    workload_remove_directory (dir);
+    g_main_loop_unref (loop);
+    return EXIT_FAILURE;
+  }
+
+  workload_remove_directory (dir);
+  g_main_loop_unref (loop);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,373 @@
+#include "chunker.h"
+#include "callback-sink.h"
+#include "workload.h"
+
+#include <gst/gst.h>
+#include <gst/base/base.h>
+#include <gst/check/gsttestclock.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Drives a chunker with a scripted live source on a test clock and measures
+ * how long it takes from the start of a silence gap to the split, and how far
+ * the split lands from where it ideally should. The clock is advanced as soon
+ * as anything waits on it, so the runs are much faster than real time.
+ */
+
+static int rate = 16000;
+static int length = 600;
+static int runs = 10;
+static int buffer_time = 10;
+static int seed = 42;
+
+static GOptionEntry entries[] =
+{
+  { "rate", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &rate,
+    "The sample rate of the live source (default: 16000)", "R" },
+  { "length", 'l', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &length,
+    "The length of each run in seconds (default: 600)", "L" },
+  { "runs", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &runs,
+    "The number of runs with consecutive seeds (default: 10)", "N" },
+  { "buffer-time", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &buffer_time,
+    "The length of the buffers of the live source in milliseconds (default: 10)", "B" },
+  { "seed", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &seed,
+    "The seed of the first run (default: 42)", "S" },
+  G_OPTION_ENTRY_NULL,
+};
+
+
+#define SCRIPT_TYPE_SRC script_src_get_type ()
+G_DECLARE_FINAL_TYPE (ScriptSrc, script_src, SCRIPT, SRC, GstPushSrc)
+
+struct _ScriptSrc {
+  GstPushSrc   parent;
+
+  GArray      *script;
+  GRand       *rand;
+  gint         rate;
+  guint        samples_per_buffer;
+  guint        segment;
+  guint64      offset;
+  GstClockTime position;
+};
+
+G_DEFINE_TYPE (ScriptSrc, script_src, GST_TYPE_PUSH_SRC)
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+                                                                   GST_PAD_SRC,
+                                                                   GST_PAD_ALWAYS,
+                                                                   GST_STATIC_CAPS ("audio/x-raw, "
+                                                                                    "format = (string) S16LE, "
+                                                                                    "layout = (string) interleaved, "
+                                                                                    "channels = (int) 1, "
+                                                                                    "rate = (int) [ 1, MAX ]"));
+
+
+static gboolean
+script_src_negotiate (GstBaseSrc *src)
+{
+  ScriptSrc *self = SCRIPT_SRC (src);
+  g_autoptr (GstCaps) caps = NULL;
+
+  caps = gst_caps_new_simple ("audio/x-raw",
+                              "format", G_TYPE_STRING, "S16LE",
+                              "layout", G_TYPE_STRING, "interleaved",
+                              "channels", G_TYPE_INT, 1,
+                              "rate", G_TYPE_INT, self->rate,
+                              NULL);
+
+  return gst_base_src_set_caps (src, caps);
+}
+
+
+/* Like a capture device, a buffer is ready only once all of it was recorded. */
+static void
+script_src_get_times (GstBaseSrc   *src,
+                      GstBuffer    *buffer,
+                      GstClockTime *start,
+                      GstClockTime *end)
+{
+  *start = GST_BUFFER_PTS (buffer) + GST_BUFFER_DURATION (buffer);
+  *end = GST_CLOCK_TIME_NONE;
+}
+
+
+static GstFlowReturn
+script_src_create (GstPushSrc *src, GstBuffer **buffer)
+{
+  ScriptSrc *self = SCRIPT_SRC (src);
+  const WorkloadSegment *segment;
+  GstMapInfo info;
+  gint16 *samples;
+  guint64 n_samples;
+  guint64 n;
+
+  segment = &g_array_index (self->script, WorkloadSegment, self->script->len - 1);
+  n_samples = segment->offset + segment->n_samples;
+
+  if (self->offset >= n_samples)
+    return GST_FLOW_EOS;
+
+  n = MIN (self->samples_per_buffer, n_samples - self->offset);
+  *buffer = gst_buffer_new_allocate (NULL, n * sizeof (gint16), NULL);
+
+  gst_buffer_map (*buffer, &info, GST_MAP_WRITE);
+  samples = (gint16 *) info.data;
+
+  for (guint64 i = 0; i < n; i++) {
+    segment = &g_array_index (self->script, WorkloadSegment, self->segment);
+
+    while (self->offset + i >= segment->offset + segment->n_samples) {
+      self->segment++;
+      segment++;
+    }
+
+    samples[i] = workload_sample (segment, self->rate, self->offset + i, self->rand);
+  }
+
+  gst_buffer_unmap (*buffer, &info);
+
+  GST_BUFFER_PTS (*buffer) = gst_util_uint64_scale_int (self->offset, GST_SECOND, self->rate);
+  self->offset += n;
+  self->position = gst_util_uint64_scale_int (self->offset, GST_SECOND, self->rate);
+  GST_BUFFER_DURATION (*buffer) = self->position - GST_BUFFER_PTS (*buffer);
+
+  return GST_FLOW_OK;
+}
+
+
+static void
+script_src_finalize (GObject *object)
+{
+  ScriptSrc *self = SCRIPT_SRC (object);
+
+  g_clear_pointer (&self->script, g_array_unref);
+  g_clear_pointer (&self->rand, g_rand_free);
+
+  G_OBJECT_CLASS (script_src_parent_class)->finalize (object);
+}
+
+
+static void
+script_src_class_init (ScriptSrcClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *base_src_class = GST_BASE_SRC_CLASS (klass);
+  GstPushSrcClass *push_src_class = GST_PUSH_SRC_CLASS (klass);
+
+  object_class->finalize = script_src_finalize;
+
+  base_src_class->negotiate = script_src_negotiate;
+  base_src_class->get_times = script_src_get_times;
+  push_src_class->create = script_src_create;
+
+  gst_element_class_add_static_pad_template (element_class, &srctemplate);
+
+  gst_element_class_set_static_metadata (element_class,
+                                         "ScriptSrc",
+                                         "Source/Audio",
+                                         "Plays a scripted workload live",
+                                         "Arun Mani J <arunmani@peartree.to>");
+}
+
+
+static void
+script_src_init (ScriptSrc *self)
+{
+  gst_base_src_set_live (GST_BASE_SRC (self), TRUE);
+  gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
+}
+
+
+static GstElement *
+script_src_new (guint32 seed, gint rate, guint64 n_samples)
+{
+  ScriptSrc *self = g_object_new (SCRIPT_TYPE_SRC, NULL);
+
+  self->script = workload_script_new (seed, rate, n_samples);
+  self->rand = g_rand_new_with_seed (seed);
+  self->rate = rate;
+  self->samples_per_buffer = MAX (1, rate * buffer_time / 1000);
+
+  return GST_ELEMENT (self);
+}
+
+
+typedef struct {
+  ScriptSrc *src;
+  GstClock  *clock;
+  GArray    *latencies;
+  GArray    *errors;
+  gboolean  *gaps_split;
+  guint      spurious;
+} Run;
+
+
+static void
+on_chunked (MarsChunker *chunker, Run *run)
+{
+  const WorkloadSegment *gap = NULL;
+  GstClockTime position = run->src->position;
+  GstClockTime gap_start;
+  gint64 latency;
+  gint64 error;
+  guint i;
+
+  for (i = 0; i < run->src->script->len; i++) {
+    const WorkloadSegment *segment = &g_array_index (run->src->script, WorkloadSegment, i);
+
+    if (gst_util_uint64_scale_int (segment->offset, GST_SECOND, rate) > position)
+      break;
+
+    if (!segment->speech)
+      gap = segment;
+  }
+
+  if (gap == NULL) {
+    run->spurious++;
+    return;
+  }
+
+  i = gap - &g_array_index (run->src->script, WorkloadSegment, 0);
+
+  if (run->gaps_split[i] ||
+      gst_util_uint64_scale_int (gap->n_samples, GST_SECOND, rate) < MARS_CHUNKER_MINIMUM_SILENCE_TIME) {
+    run->spurious++;
+    return;
+  }
+
+  run->gaps_split[i] = TRUE;
+  gap_start = gst_util_uint64_scale_int (gap->offset, GST_SECOND, rate);
+  latency = gst_clock_get_time (run->clock) - gap_start;
+  error = position - gap_start - (MARS_CHUNKER_MINIMUM_SILENCE_TIME);
+
+  g_array_append_val (run->latencies, latency);
+  g_array_append_val (run->errors, error);
+}
+
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+
+static gdouble
+percentile (GArray *values, gdouble percentile)
+{
+  guint index;
+
+  if (values->len == 0)
+    return 0;
+
+  index = MIN (values->len - 1, (guint) (values->len * percentile / 100));
+
+  return (gdouble) g_array_index (values, gint64, index) / GST_MSECOND;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context;
+  g_autoptr (GArray) latencies = NULL;
+  g_autoptr (GArray) errors = NULL;
+  guint expected = 0;
+  guint missed = 0;
+  guint spurious = 0;
+  gint64 begin;
+  gdouble seconds;
+
+  context = g_option_context_new ("Measure the split latency on a simulated live source");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("Error: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  gst_init (&argc, &argv);
+
+  latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  errors = g_array_new (FALSE, FALSE, sizeof (gint64));
+  begin = g_get_monotonic_time ();
+
+  for (int i = 0; i < runs; i++) {
+    g_autoptr (MarsChunker) chunker = NULL;
+    g_autoptr (GstClock) clock = NULL;
+    g_autofree gboolean *gaps_split = NULL;
+    ScriptSrc *src;
+    Run run;
+
+    clock = gst_test_clock_new ();
+    src = SCRIPT_SRC (script_src_new (seed + i, rate, (guint64) rate * length));
+    gaps_split = g_new0 (gboolean, src->script->len);
+
+    run = (Run) {
+      .src = src,
+      .clock = clock,
+      .latencies = latencies,
+      .errors = errors,
+      .gaps_split = gaps_split,
+    };
+
+    chunker = g_object_new (MARS_TYPE_CHUNKER,
+                            "src", src,
+                            "sink", mars_callback_sink_new (),
+                            "muxer", "wavenc",
+                            "rate", rate,
+                            "clock", clock,
+                            NULL);
+    g_signal_connect (chunker, "chunked", G_CALLBACK (on_chunked), &run);
+
+    mars_chunker_play (chunker);
+
+    while (mars_chunker_is_playing (chunker)) {
+      if (gst_test_clock_timed_wait_for_multiple_pending_ids (GST_TEST_CLOCK (clock), 1, 100, NULL))
+        gst_test_clock_crank (GST_TEST_CLOCK (clock));
+    }
+
+    for (guint j = 0; j < src->script->len; j++) {
+      const WorkloadSegment *segment = &g_array_index (src->script, WorkloadSegment, j);
+
+      if (segment->speech ||
+          gst_util_uint64_scale_int (segment->n_samples, GST_SECOND, rate) < MARS_CHUNKER_MINIMUM_SILENCE_TIME)
+        continue;
+
+      expected++;
+
+      if (!gaps_split[j])
+        missed++;
+    }
+
+    spurious += run.spurious;
+  }
+
+  seconds = (gdouble) (g_get_monotonic_time () - begin) / G_USEC_PER_SEC;
+
+  g_array_sort (latencies, compare_int64);
+  g_array_sort (errors, compare_int64);
+
+  printf ("{\"rate\": %d, \"length\": %d, \"runs\": %d, \"buffer-time-ms\": %d, "
+          "\"expected\": %u, \"split\": %u, \"missed\": %u, \"spurious\": %u, "
+          "\"latency-ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+          "\"boundary-error-ms\": {\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+          "\"seconds\": %.3f, \"speed\": %.1f}\n",
+          rate, length, runs, buffer_time,
+          expected, latencies->len, missed, spurious,
+          percentile (latencies, 50), percentile (latencies, 90),
+          percentile (latencies, 99), percentile (latencies, 100),
+          percentile (errors, 0), percentile (errors, 50), percentile (errors, 90),
+          percentile (errors, 99), percentile (errors, 100),
+          seconds, seconds > 0 ? (gdouble) runs * length / seconds : 0);
+
+  return EXIT_SUCCESS;
+}
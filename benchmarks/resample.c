@@ -0,0 +1,201 @@
+#include "resample.h"
+
+#include <gst/gst.h>
+#include <gst/check/gstharness.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Feeds the same tones through `audioresample` and `marsresample` and prints
+ * their speed and their error against the exact tones at the output rate. The
+ * tones above the output Nyquist frequency should be filtered out, so they
+ * are left out of the reference.
+ */
+
+static int in_rate = 48000;
+static int out_rate = 16000;
+static int quality = 4;
+static int length = 600;
+static int buffer_time = 20;
+
+static GOptionEntry entries[] =
+{
+  { "in-rate", 'i', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &in_rate,
+    "The sample rate of the input (default: 48000)", "I" },
+  { "out-rate", 'o', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &out_rate,
+    "The sample rate of the output (default: 16000)", "O" },
+  { "quality", 'q', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &quality,
+    "The quality of both resamplers from 0 to 10 (default: 4)", "Q" },
+  { "length", 'l', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &length,
+    "The length of the input in seconds (default: 600)", "L" },
+  { "buffer-time", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &buffer_time,
+    "The length of the input buffers in milliseconds (default: 20)", "B" },
+  G_OPTION_ENTRY_NULL,
+};
+
+static const gdouble frequencies[] = { 300, 1000, 2500, 10000, 15000 };
+#define AMPLITUDE 3000
+#define PASSBAND 0.45
+#define MAX_LAG 8
+
+
+static gdouble
+tones (gint rate, guint64 offset, gboolean passband_only)
+{
+  gdouble sum = 0;
+
+  for (guint i = 0; i < G_N_ELEMENTS (frequencies); i++) {
+    if (passband_only && frequencies[i] >= PASSBAND * out_rate)
+      continue;
+
+    sum += AMPLITUDE * sin (2 * G_PI * frequencies[i] * offset / rate);
+  }
+
+  return sum;
+}
+
+
+typedef struct {
+  gdouble seconds;
+  gdouble snr;
+} Result;
+
+
+/* Signal-to-noise ratio in dB at the best alignment, skipping the edges. */
+static gdouble
+measure_snr (GArray *output)
+{
+  gdouble best = -INFINITY;
+  guint margin = out_rate / 10;
+
+  if (output->len <= 2 * margin + MAX_LAG)
+    return 0;
+
+  for (gint lag = -MAX_LAG; lag <= MAX_LAG; lag++) {
+    gdouble signal = 0;
+    gdouble noise = 0;
+
+    for (guint i = margin; i < output->len - margin; i++) {
+      gdouble reference = tones (out_rate, i + lag, TRUE);
+      gdouble error = g_array_index (output, gint16, i) - reference;
+
+      signal += reference * reference;
+      noise += error * error;
+    }
+
+    best = MAX (best, noise > 0 ? 10 * log10 (signal / noise) : INFINITY);
+  }
+
+  return best;
+}
+
+
+static Result
+run (const char *element, const gint16 *input, guint64 n_samples)
+{
+  g_autoptr (GArray) output = g_array_new (FALSE, FALSE, sizeof (gint16));
+  g_autofree char *description = NULL;
+  g_autofree char *src_caps = NULL;
+  g_autofree char *sink_caps = NULL;
+  guint64 samples_per_buffer = (guint64) in_rate * buffer_time / 1000;
+  GstHarness *harness;
+  GstBuffer *buffer;
+  gint64 begin;
+  Result result;
+
+  if (g_str_equal (element, "marsresample"))
+    description = g_strdup_printf ("marsresample rate=%d quality=%d", out_rate, quality);
+  else
+    description = g_strdup_printf ("%s quality=%d", element, quality);
+
+  src_caps = g_strdup_printf ("audio/x-raw, format=S16LE, layout=interleaved, "
+                              "channels=1, rate=%d", in_rate);
+  sink_caps = g_strdup_printf ("audio/x-raw, format=S16LE, layout=interleaved, "
+                               "channels=1, rate=%d", out_rate);
+
+  harness = gst_harness_new_parse (description);
+  gst_harness_set_src_caps_str (harness, src_caps);
+  gst_harness_set_sink_caps_str (harness, sink_caps);
+
+  begin = g_get_monotonic_time ();
+
+  for (guint64 offset = 0; offset < n_samples; offset += samples_per_buffer) {
+    guint64 n = MIN (samples_per_buffer, n_samples - offset);
+
+    buffer = gst_buffer_new_memdup (input + offset, n * sizeof (gint16));
+    GST_BUFFER_PTS (buffer) = gst_util_uint64_scale_int (offset, GST_SECOND, in_rate);
+    GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale_int (n, GST_SECOND, in_rate);
+    gst_harness_push (harness, buffer);
+
+    while ((buffer = gst_harness_try_pull (harness)) != NULL) {
+      GstMapInfo info;
+
+      gst_buffer_map (buffer, &info, GST_MAP_READ);
+      g_array_append_vals (output, info.data, info.size / sizeof (gint16));
+      gst_buffer_unmap (buffer, &info);
+      gst_buffer_unref (buffer);
+    }
+  }
+
+  gst_harness_push_event (harness, gst_event_new_eos ());
+
+  while ((buffer = gst_harness_try_pull (harness)) != NULL) {
+    GstMapInfo info;
+
+    gst_buffer_map (buffer, &info, GST_MAP_READ);
+    g_array_append_vals (output, info.data, info.size / sizeof (gint16));
+    gst_buffer_unmap (buffer, &info);
+    gst_buffer_unref (buffer);
+  }
+
+  result.seconds = (gdouble) (g_get_monotonic_time () - begin) / G_USEC_PER_SEC;
+  result.snr = measure_snr (output);
+
+  gst_harness_teardown (harness);
+
+  return result;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context;
+  g_autofree gint16 *input = NULL;
+  guint64 n_samples;
+  Result generic;
+  Result polyphase;
+
+  context = g_option_context_new ("Compare marsresample with audioresample");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("Error: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  gst_init (&argc, &argv);
+  mars_resample_register ();
+
+  n_samples = (guint64) in_rate * length;
+  input = g_new (gint16, n_samples);
+
+  for (guint64 i = 0; i < n_samples; i++)
+    input[i] = (gint16) lrint (tones (in_rate, i, FALSE));
+
+  generic = run ("audioresample", input, n_samples);
+  polyphase = run ("marsresample", input, n_samples);
+
+  printf ("{\"in-rate\": %d, \"out-rate\": %d, \"quality\": %d, \"length\": %d, "
+          "\"audioresample-real-time-factor\": %.6f, \"marsresample-real-time-factor\": %.6f, "
+          "\"speedup\": %.3f, \"audioresample-snr-db\": %.2f, \"marsresample-snr-db\": %.2f}\n",
+          in_rate, out_rate, quality, length,
+          generic.seconds / length, polyphase.seconds / length,
+          polyphase.seconds > 0 ? generic.seconds / polyphase.seconds : 0,
+          generic.snr, polyphase.snr);
+
+  return EXIT_SUCCESS;
+}
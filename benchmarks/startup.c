@@ -0,0 +1,222 @@
+#include "chunker.h"
+#include "mars.h"
+#include "workload.h"
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Measures the time to the first chunk from the start of a fresh process.
+ * The benchmark spawns itself for every run, and the child reports when it
+ * was ready for a job, when the job started and when the first chunk was
+ * pulled, all on the monotonic clock shared with the parent.
+ *
+ * `cold` creates the chunker right away and `prewarm` calls mars_init()
+ * before the job.
+ */
+
+static int rate = 48000;
+static int length = 30;
+static int runs = 5;
+static int seed = 42;
+static char *mode = NULL;
+static char *input = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "rate", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &rate,
+    "The sample rate of the generated workload (default: 48000)", "R" },
+  { "length", 'l', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &length,
+    "The length of the generated workload in seconds (default: 30)", "L" },
+  { "runs", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &runs,
+    "The number of processes for each mode (default: 5)", "N" },
+  { "seed", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &seed,
+    "The seed of the generated workload (default: 42)", "S" },
+  { "mode", 'm', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &mode,
+    "Run a single job as \"cold\" or \"prewarm\"", "M" },
+  { "input", 'i', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &input,
+    "The input of the single job", "I" },
+  G_OPTION_ENTRY_NULL,
+};
+
+static const char * const MODES[] = { "cold", "prewarm" };
+
+
+static MarsChunker *
+new_chunker (const char *location)
+{
+  return g_object_new (MARS_TYPE_CHUNKER,
+                       "input", location,
+                       "muxer", "wavenc",
+                       "rate", 16000,
+                       "max-queued-chunks", 1,
+                       NULL);
+}
+
+
+static int
+run_job (gint64 begin, int argc, char **argv)
+{
+  g_autoptr (MarsChunker) chunker = NULL;
+  g_autoptr (GstBufferList) chunk = NULL;
+  g_autoptr (GError) error = NULL;
+  gint64 ready;
+  gint64 job;
+
+  if (g_strcmp0 (mode, "cold") == 0) {
+    gst_init (&argc, &argv);
+    ready = begin;
+  } else {
+    mars_init (&argc, &argv);
+    ready = g_get_monotonic_time ();
+  }
+
+  job = g_get_monotonic_time ();
+
+  chunker = new_chunker (input);
+
+  mars_chunker_play (chunker);
+  chunk = mars_chunker_next_chunk (chunker, NULL, &error);
+
+  if (chunk == NULL) {
+    g_printerr ("Error: %s\n", error != NULL ? error->message : "No chunk");
+    return EXIT_FAILURE;
+  }
+
+  printf ("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+          ready, job, g_get_monotonic_time ());
+  mars_chunker_stop (chunker);
+
+  return EXIT_SUCCESS;
+}
+
+
+/* Spawns a job and gives its times relative to the spawn in milliseconds. */
+static gboolean
+spawn_job (const char *program, const char *job_mode, const char *path, gdouble times[3])
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree char *output = NULL;
+  const char *argv[] = { program, "--mode", job_mode, "--input", path, NULL };
+  gint64 begin;
+  gint64 ready;
+  gint64 job;
+  gint64 first;
+  int status;
+
+  begin = g_get_monotonic_time ();
+
+  if (!g_spawn_sync (NULL, (char **) argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
+                     &output, NULL, &status, &error)) {
+    g_printerr ("Error: %s\n", error->message);
+    return FALSE;
+  }
+
+  if (!g_spawn_check_wait_status (status, NULL) ||
+      sscanf (output, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GINT64_FORMAT,
+              &ready, &job, &first) != 3)
+    return FALSE;
+
+  times[0] = (gdouble) (ready - begin) / 1000;
+  times[1] = (gdouble) (first - job) / 1000;
+  times[2] = (gdouble) (first - begin) / 1000;
+
+  return TRUE;
+}
+
+
+static gint
+compare_double (gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a;
+  gdouble y = *(const gdouble *) b;
+
+  return (x > y) - (x < y);
+}
+
+
+static gdouble
+median (GArray *values)
+{
+  g_array_sort (values, compare_double);
+
+  return values->len != 0 ? g_array_index (values, gdouble, values->len / 2) : 0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  gint64 begin = g_get_monotonic_time ();
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context;
+  g_autofree char *dir = NULL;
+  g_autofree char *path = NULL;
+  int status = EXIT_SUCCESS;
+
+  context = g_option_context_new ("Measure the time to the first chunk of a fresh process");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("Error: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  if (mode != NULL)
+    return run_job (begin, argc, argv);
+
+  dir = g_dir_make_tmp ("mars-bench-XXXXXX", &error);
+
+  if (dir == NULL) {
+    g_printerr ("Error: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  path = g_build_filename (dir, "input.wav", NULL);
+
+  if (!workload_write_wav (path, seed, rate, (guint64) rate * length)) {
+    g_printerr ("Error: Unable to write %s\n", path);
+    workload_remove_directory (dir);
+    return EXIT_FAILURE;
+  }
+
+  for (guint i = 0; i < G_N_ELEMENTS (MODES); i++) {
+    g_autoptr (GArray) ready = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    g_autoptr (GArray) job = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    g_autoptr (GArray) first = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    gdouble times[3];
+
+    /* The first process may still have to build the plugin registry. */
+    if (!spawn_job (argv[0], MODES[i], path, times)) {
+      status = EXIT_FAILURE;
+      break;
+    }
+
+    for (int j = 0; j < runs; j++) {
+      if (!spawn_job (argv[0], MODES[i], path, times)) {
+        status = EXIT_FAILURE;
+        break;
+      }
+
+      g_array_append_val (ready, times[0]);
+      g_array_append_val (job, times[1]);
+      g_array_append_val (first, times[2]);
+    }
+
+    if (status != EXIT_SUCCESS)
+      break;
+
+    printf ("{\"mode\": \"%s\", \"rate\": %d, \"runs\": %d, \"ready-ms\": %.3f, "
+            "\"job-to-first-chunk-ms\": %.3f, \"start-to-first-chunk-ms\": %.3f}\n",
+            MODES[i], rate, runs, median (ready), median (job), median (first));
+  }
+
+  workload_remove_directory (dir);
+
+  if (status != EXIT_SUCCESS)
+    g_printerr ("Error: A job failed\n");
+
+  return status;
+}
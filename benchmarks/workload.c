@@ -0,0 +1,148 @@
+#include "workload.h"
+
+#include <glib/gstdio.h>
+
+#include <math.h>
+#include <stdio.h>
+
+
+GArray *
+workload_script_new (guint32 seed, gint rate, guint64 n_samples)
+{
+  g_autoptr (GRand) rand = g_rand_new_with_seed (seed);
+  GArray *script;
+  guint64 offset = 0;
+  gboolean speech = TRUE;
+
+  script = g_array_new (FALSE, FALSE, sizeof (WorkloadSegment));
+
+  while (offset < n_samples) {
+    WorkloadSegment segment;
+    gdouble seconds;
+
+    /* Speech stays below the default maximum chunk time and some of the gaps
+     * are shorter than the default minimum silence time. */
+    if (speech)
+      seconds = g_rand_double_range (rand, 1, 5);
+    else
+      seconds = g_rand_double_range (rand, 0.1, 2);
+
+    segment.speech = speech;
+    segment.offset = offset;
+    segment.n_samples = MIN ((guint64) (seconds * rate), n_samples - offset);
+    segment.pitch = g_rand_double_range (rand, 90, 250);
+    g_array_append_val (script, segment);
+
+    offset += segment.n_samples;
+    speech = !speech;
+  }
+
+  return script;
+}
+
+
+/*
+ * Speech is imitated by a few harmonics modulated at syllable rate with some
+ * noise. Silence is noise well below the default threshold of the chunker.
+ */
+gint16
+workload_sample (const WorkloadSegment *segment, gint rate, guint64 offset, GRand *rand)
+{
+  gdouble t = (gdouble) (offset - segment->offset) / rate;
+  gdouble noise = g_rand_double_range (rand, -1, 1);
+  gdouble pitch = segment->pitch;
+  gdouble value;
+
+  if (segment->speech) {
+    value = (sin (2 * G_PI * pitch * t) +
+             0.5 * sin (4 * G_PI * pitch * t) +
+             0.25 * sin (6 * G_PI * pitch * t)) *
+            (0.6 + 0.4 * sin (2 * G_PI * 4 * t)) * 0.3 + noise * 0.02;
+  } else {
+    value = noise * 0.0001;
+  }
+
+  return (gint16) CLAMP (value * G_MAXINT16, G_MININT16, G_MAXINT16);
+}
+
+
+static void
+write_u32 (FILE *file, guint32 value)
+{
+  value = GUINT32_TO_LE (value);
+  fwrite (&value, sizeof (value), 1, file);
+}
+
+
+static void
+write_u16 (FILE *file, guint16 value)
+{
+  value = GUINT16_TO_LE (value);
+  fwrite (&value, sizeof (value), 1, file);
+}
+
+
+/* Writes the workload as a mono 16 bit WAV file. */
+gboolean
+workload_write_wav (const char *path, guint32 seed, gint rate, guint64 n_samples)
+{
+  g_autoptr (GRand) rand = g_rand_new_with_seed (seed);
+  g_autoptr (GArray) script = NULL;
+  g_autofree gint16 *samples = NULL;
+  FILE *file;
+
+  file = g_fopen (path, "wb");
+
+  if (file == NULL)
+    return FALSE;
+
+  fwrite ("RIFF", 1, 4, file);
+  write_u32 (file, 36 + n_samples * 2);
+  fwrite ("WAVEfmt ", 1, 8, file);
+  write_u32 (file, 16);
+  write_u16 (file, 1);
+  write_u16 (file, 1);
+  write_u32 (file, rate);
+  write_u32 (file, rate * 2);
+  write_u16 (file, 2);
+  write_u16 (file, 16);
+  fwrite ("data", 1, 4, file);
+  write_u32 (file, n_samples * 2);
+
+  script = workload_script_new (seed, rate, n_samples);
+  samples = g_new (gint16, rate);
+
+  for (guint i = 0; i < script->len; i++) {
+    const WorkloadSegment *segment = &g_array_index (script, WorkloadSegment, i);
+    guint64 end = segment->offset + segment->n_samples;
+
+    for (guint64 offset = segment->offset; offset < end; offset += rate) {
+      guint64 n = MIN ((guint64) rate, end - offset);
+
+      for (guint64 j = 0; j < n; j++)
+        samples[j] = workload_sample (segment, rate, offset + j, rand);
+
+      fwrite (samples, sizeof (gint16), n, file);
+    }
+  }
+
+  return fclose (file) == 0;
+}
+
+
+void
+workload_remove_directory (const char *path)
+{
+  g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+  const char *name;
+
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    g_autofree char *child = g_build_filename (path, name, NULL);
+    g_unlink (child);
+  }
+
+  g_rmdir (path);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A workload is a script of alternating speech and silence segments, starting
+ * with speech. The same seed always gives the same script and samples.
+ */
+typedef struct {
+  gboolean speech;
+  guint64  offset;
+  guint64  n_samples;
+  gdouble  pitch;
+} WorkloadSegment;
+
+GArray *workload_script_new (guint32 seed, gint rate, guint64 n_samples);
+gint16  workload_sample (const WorkloadSegment *segment, gint rate, guint64 offset, GRand *rand);
+
+gboolean workload_write_wav (const char *path, guint32 seed, gint rate, guint64 n_samples);
+void     workload_remove_directory (const char *path);
+
+G_END_DECLS
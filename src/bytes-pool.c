@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-bytes-pool"
+
+#include "bytes-pool.h"
+
+#include <string.h>
+
+/*
+ * Joins the buffers of a chunk into one block of memory. The blocks are kept
+ * once the returned bytes are freed and reused for the next chunks, so that
+ * steady chunking does not allocate. The pool lives as long as any of its
+ * bytes, which may outlive the chunker.
+ */
+
+struct _MarsBytesPool {
+  gatomicrefcount ref_count;
+  guint      max_idle;
+
+  GMutex     lock;
+  GPtrArray *idle;
+};
+
+typedef struct {
+  MarsBytesPool *pool;
+  GByteArray    *array;
+} Lease;
+
+
+MarsBytesPool *
+mars_bytes_pool_new (guint max_idle)
+{
+  MarsBytesPool *self = g_new0 (MarsBytesPool, 1);
+
+  g_atomic_ref_count_init (&self->ref_count);
+  self->max_idle = max_idle;
+  self->idle = g_ptr_array_new_with_free_func ((GDestroyNotify) g_byte_array_unref);
+  g_mutex_init (&self->lock);
+
+  return self;
+}
+
+
+MarsBytesPool *
+mars_bytes_pool_ref (MarsBytesPool *self)
+{
+  g_atomic_ref_count_inc (&self->ref_count);
+
+  return self;
+}
+
+
+void
+mars_bytes_pool_unref (MarsBytesPool *self)
+{
+  if (!g_atomic_ref_count_dec (&self->ref_count))
+    return;
+
+  g_ptr_array_unref (self->idle);
+  g_mutex_clear (&self->lock);
+  g_free (self);
+}
+
+
+static GByteArray *
+acquire (MarsBytesPool *self)
+{
+  GByteArray *array = NULL;
+
+  g_mutex_lock (&self->lock);
+
+  if (self->idle->len > 0)
+    array = g_ptr_array_steal_index_fast (self->idle, self->idle->len - 1);
+
+  g_mutex_unlock (&self->lock);
+
+  return array != NULL ? array : g_byte_array_new ();
+}
+
+
+static void
+release (Lease *lease)
+{
+  MarsBytesPool *self = lease->pool;
+
+  g_mutex_lock (&self->lock);
+
+  if (self->idle->len < self->max_idle) {
+    g_ptr_array_add (self->idle, lease->array);
+    lease->array = NULL;
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  g_clear_pointer (&lease->array, g_byte_array_unref);
+  mars_bytes_pool_unref (self);
+  g_free (lease);
+}
+
+
+/* Where the buffer goes in the chunk, following the previous one without an offset. */
+static gsize
+get_position (GstBuffer *buffer, gsize position)
+{
+  return GST_BUFFER_OFFSET_IS_VALID (buffer) ? GST_BUFFER_OFFSET (buffer) : position;
+}
+
+
+/*
+ * Writes every buffer at its byte offset, so that a header rewritten at the
+ * end of the stream replaces the one at the start.
+ */
+GBytes *
+mars_bytes_pool_collect (MarsBytesPool *self, GstBufferList *buffers)
+{
+  Lease *lease;
+  gsize position = 0;
+  gsize size = 0;
+  gboolean gaps = FALSE;
+  guint length = gst_buffer_list_length (buffers);
+
+  for (guint i = 0; i < length; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (buffers, i);
+
+    position = get_position (buffer, position);
+    gaps |= position > size;
+    position += gst_buffer_get_size (buffer);
+    size = MAX (size, position);
+  }
+
+  lease = g_new (Lease, 1);
+  lease->pool = mars_bytes_pool_ref (self);
+  lease->array = acquire (self);
+
+  /* Grows the block once for the whole chunk; it keeps the size when reused. */
+  g_byte_array_set_size (lease->array, size);
+
+  if (gaps)
+    memset (lease->array->data, 0, size);
+
+  position = 0;
+
+  for (guint i = 0; i < length; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (buffers, i);
+
+    position = get_position (buffer, position);
+    position += gst_buffer_extract (buffer, 0, lease->array->data + position,
+                                    size - position);
+  }
+
+  return g_bytes_new_with_free_func (lease->array->data, size,
+                                     (GDestroyNotify) release, lease);
+}
+
+
+/* Whether every buffer follows the previous one, so it is a file as it is. */
+gboolean
+mars_bytes_pool_is_sequential (GstBufferList *buffers)
+{
+  gsize position = 0;
+  guint length = gst_buffer_list_length (buffers);
+
+  for (guint i = 0; i < length; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (buffers, i);
+
+    if (get_position (buffer, position) != position)
+      return FALSE;
+
+    position += gst_buffer_get_size (buffer);
+  }
+
+  return TRUE;
+}
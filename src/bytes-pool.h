@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MarsBytesPool MarsBytesPool;
+
+MarsBytesPool *mars_bytes_pool_new (guint max_idle);
+MarsBytesPool *mars_bytes_pool_ref (MarsBytesPool *self);
+void           mars_bytes_pool_unref (MarsBytesPool *self);
+
+GBytes        *mars_bytes_pool_collect (MarsBytesPool *self, GstBufferList *buffers);
+gboolean       mars_bytes_pool_is_sequential (GstBufferList *buffers);
+
+G_END_DECLS
@@ -9,8 +9,12 @@
 #define G_LOG_DOMAIN "mars-callback-sink"
 
 #include "callback-sink.h"
+#include "stats.h"
 
+#include <errno.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
+#include <unistd.h>
 
 /**
  * MarsCallbackSink:
@@ -19,8 +23,48 @@
  * with an array of buffers.
  *
  * For all the callbacks, the arguments should not be freed.
+ *
+ * Buffer lists from upstream are rendered at once. With a batch callback,
+ * buffers are also coalesced into batches of
+ * [property@Mars.CallbackSink:batch-time], so that small buffers from
+ * microphones do not cost a call each. Buffers are only aggregated for the
+ * buffer list callback if it is set before the stream starts.
+ *
+ * The aggregated buffers carry their byte position in the stream as their
+ * offset. Like `filesink`, a byte segment moves the position, so the chunks
+ * of muxers that go back to rewrite their header can be put together by
+ * writing every buffer at its offset.
+ *
+ * With [property@Mars.CallbackSink:memory-limit], the oldest aggregated buffers
+ * are spilled to an unlinked temporary file and handed back as mapped memory
+ * when the stream ends.
+ *
+ * [property@GstBase.BaseSink:stats] is extended with the counters of the sink
+ * and can be polled from any thread.
  */
 
+enum {
+  PROP_0,
+  PROP_STATS,
+  PROP_MEMORY_LIMIT,
+  PROP_BATCH_TIME,
+  PROP_LAST_PROP,
+};
+
+static GParamSpec *props[PROP_LAST_PROP];
+
+/* Everything of a spilled buffer except its data, which is in the spill file. */
+typedef struct {
+  guint64      position;
+  gsize        size;
+  GstClockTime pts;
+  GstClockTime dts;
+  GstClockTime duration;
+  guint64      offset;
+  guint64      offset_end;
+  guint        flags;
+} SpilledBuffer;
+
 static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
                                                                     GST_PAD_SINK,
                                                                     GST_PAD_ALWAYS,
@@ -35,47 +79,487 @@ struct _MarsCallbackSink {
   MarsBufferListCallback buffer_list_cb;
   gpointer               buffer_list_cb_user_data;
   GDestroyNotify         buffer_list_cb_destroy;
+  MarsBufferListCallback batch_cb;
+  gpointer               batch_cb_user_data;
+  GDestroyNotify         batch_cb_destroy;
   GstBufferList         *buffers;
+  GstBufferList         *batch;
+  guint64                batch_time;
+  guint64                batch_duration;
+  guint64                memory_limit;
+  gsize                  memory_size;
+  guint64                position;
+  GArray                *spilled;
+  int                    spill_fd;
+  guint64                spill_size;
+
+  /* Updated from the streaming thread without locking. */
+  struct {
+    MarsCounter   buffers;
+    MarsCounter   bytes;
+    MarsCounter   buffer_time;
+    MarsCounter   start_time;
+    MarsCounter   elapsed_time;
+    MarsCounter   spilled_bytes;
+    MarsHistogram callback_time;
+  } stats;
 };
 
 G_DEFINE_TYPE (MarsCallbackSink, mars_callback_sink, GST_TYPE_BASE_SINK)
 
 
+static GstStructure *
+get_stats (MarsCallbackSink *self)
+{
+  GstStructure *structure;
+  guint64 buffer_time;
+  guint64 elapsed_time;
+  guint64 start_time;
+  gdouble real_time_factor = 0;
+
+  buffer_time = mars_counter_get (&self->stats.buffer_time);
+  elapsed_time = mars_counter_get (&self->stats.elapsed_time);
+  start_time = mars_counter_get (&self->stats.start_time);
+
+  if (start_time != 0)
+    elapsed_time += g_get_monotonic_time () - start_time;
+
+  if (buffer_time != 0)
+    real_time_factor = (gdouble) elapsed_time * GST_USECOND / buffer_time;
+
+  /* Has `average-rate`, `dropped` and `rendered` of the base sink. */
+  structure = gst_base_sink_get_stats (GST_BASE_SINK (self));
+  gst_structure_set_name (structure, "MarsCallbackSinkStats");
+  gst_structure_set (structure,
+                     "buffers", G_TYPE_UINT64, mars_counter_get (&self->stats.buffers),
+                     "bytes", G_TYPE_UINT64, mars_counter_get (&self->stats.bytes),
+                     "buffer-time", G_TYPE_UINT64, buffer_time,
+                     "callback-time-p50", G_TYPE_UINT64,
+                     mars_histogram_percentile (&self->stats.callback_time, 50),
+                     "callback-time-p90", G_TYPE_UINT64,
+                     mars_histogram_percentile (&self->stats.callback_time, 90),
+                     "callback-time-p99", G_TYPE_UINT64,
+                     mars_histogram_percentile (&self->stats.callback_time, 99),
+                     "spilled-bytes", G_TYPE_UINT64, mars_counter_get (&self->stats.spilled_bytes),
+                     "real-time-factor", G_TYPE_DOUBLE, real_time_factor,
+                     NULL);
+
+  return structure;
+}
+
+
+static void
+mars_callback_sink_set_property (GObject      *object,
+                                 guint         property_id,
+                                 const GValue *value,
+                                 GParamSpec   *pspec)
+{
+  MarsCallbackSink *self = MARS_CALLBACK_SINK (object);
+
+  switch (property_id) {
+  case PROP_MEMORY_LIMIT:
+    __atomic_store_n (&self->memory_limit, g_value_get_uint64 (value), __ATOMIC_RELAXED);
+    break;
+  case PROP_BATCH_TIME:
+    __atomic_store_n (&self->batch_time, g_value_get_uint64 (value), __ATOMIC_RELAXED);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+
+static void
+mars_callback_sink_get_property (GObject    *object,
+                                 guint       property_id,
+                                 GValue     *value,
+                                 GParamSpec *pspec)
+{
+  MarsCallbackSink *self = MARS_CALLBACK_SINK (object);
+
+  switch (property_id) {
+  case PROP_STATS:
+    g_value_take_boxed (value, get_stats (self));
+    break;
+  case PROP_MEMORY_LIMIT:
+    g_value_set_uint64 (value, __atomic_load_n (&self->memory_limit, __ATOMIC_RELAXED));
+    break;
+  case PROP_BATCH_TIME:
+    g_value_set_uint64 (value, __atomic_load_n (&self->batch_time, __ATOMIC_RELAXED));
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+
+/* Writes at @offset, so a failed write does not move the next one. */
+static gboolean
+write_all (int fd, const guint8 *data, gsize size, off_t offset)
+{
+  while (size > 0) {
+    gssize written = pwrite (fd, data, size, offset);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+
+    if (written <= 0)
+      return FALSE;
+
+    data += written;
+    size -= written;
+    offset += written;
+  }
+
+  return TRUE;
+}
+
+
+static gboolean
+spill_buffer (MarsCallbackSink *self, GstBuffer *buffer)
+{
+  SpilledBuffer spilled;
+  GstMapInfo info;
+  gboolean written;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
+    return FALSE;
+
+  written = write_all (self->spill_fd, info.data, info.size, self->spill_size);
+  gst_buffer_unmap (buffer, &info);
+
+  if (!written)
+    return FALSE;
+
+  spilled = (SpilledBuffer) {
+    .position = self->spill_size,
+    .size = info.size,
+    .pts = GST_BUFFER_PTS (buffer),
+    .dts = GST_BUFFER_DTS (buffer),
+    .duration = GST_BUFFER_DURATION (buffer),
+    .offset = GST_BUFFER_OFFSET (buffer),
+    .offset_end = GST_BUFFER_OFFSET_END (buffer),
+    .flags = GST_BUFFER_FLAGS (buffer),
+  };
+  g_array_append_val (self->spilled, spilled);
+
+  self->spill_size += info.size;
+  mars_counter_add (&self->stats.spilled_bytes, info.size);
+
+  return TRUE;
+}
+
+
+/*
+ * Spills the oldest buffers in memory until half of the limit is used, so the
+ * file is not written for every buffer once the limit is reached.
+ */
+static void
+spill_buffers (MarsCallbackSink *self, guint64 memory_limit)
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree char *path = NULL;
+  guint n_spilled = 0;
+
+  if (self->spill_fd < 0) {
+    self->spill_fd = g_file_open_tmp ("mars-callback-sink-XXXXXX", &path, &error);
+
+    if (self->spill_fd < 0) {
+      g_warning ("Unable to create spill file: %s", error->message);
+      return;
+    }
+
+    g_unlink (path);
+  }
+
+  while (self->memory_size > memory_limit / 2 &&
+         n_spilled < gst_buffer_list_length (self->buffers)) {
+    GstBuffer *buffer = gst_buffer_list_get (self->buffers, n_spilled);
+
+    if (!spill_buffer (self, buffer)) {
+      g_warning ("Unable to write spill file: %s", g_strerror (errno));
+      break;
+    }
+
+    self->memory_size -= gst_buffer_get_size (buffer);
+    n_spilled++;
+  }
+
+  g_debug ("Spilled buffers: %u", n_spilled);
+  gst_buffer_list_remove (self->buffers, 0, n_spilled);
+}
+
+
+/*
+ * Rebuilds the whole stream with the spilled buffers mapped from the file.
+ * Returns %NULL if the file cannot be mapped.
+ */
+static GstBufferList *
+restore_buffers (MarsCallbackSink *self)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GstMemory) memory = NULL;
+  GMappedFile *file;
+  GstBufferList *buffers;
+
+  file = g_mapped_file_new_from_fd (self->spill_fd, FALSE, &error);
+
+  if (file == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, READ,
+                       ("Unable to map spill file: %s", error->message), (NULL));
+    return NULL;
+  }
+
+  memory = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+                                   g_mapped_file_get_contents (file),
+                                   g_mapped_file_get_length (file),
+                                   0, g_mapped_file_get_length (file),
+                                   file, (GDestroyNotify) g_mapped_file_unref);
+
+  buffers = gst_buffer_list_new_sized (self->spilled->len + gst_buffer_list_length (self->buffers));
+
+  for (guint i = 0; i < self->spilled->len; i++) {
+    SpilledBuffer *spilled = &g_array_index (self->spilled, SpilledBuffer, i);
+    GstBuffer *buffer = gst_buffer_new ();
+
+    if (spilled->size > 0)
+      gst_buffer_append_memory (buffer, gst_memory_share (memory, spilled->position, spilled->size));
+
+    GST_BUFFER_PTS (buffer) = spilled->pts;
+    GST_BUFFER_DTS (buffer) = spilled->dts;
+    GST_BUFFER_DURATION (buffer) = spilled->duration;
+    GST_BUFFER_OFFSET (buffer) = spilled->offset;
+    GST_BUFFER_OFFSET_END (buffer) = spilled->offset_end;
+    GST_BUFFER_FLAGS (buffer) = spilled->flags;
+
+    gst_buffer_list_add (buffers, buffer);
+  }
+
+  for (guint i = 0; i < gst_buffer_list_length (self->buffers); i++)
+    gst_buffer_list_add (buffers, gst_buffer_ref (gst_buffer_list_get (self->buffers, i)));
+
+  return buffers;
+}
+
+
+static void
+clear_spill (MarsCallbackSink *self)
+{
+  if (self->spill_fd >= 0)
+    close (self->spill_fd);
+
+  self->spill_fd = -1;
+  self->spill_size = 0;
+  g_array_set_size (self->spilled, 0);
+}
+
+
 static gboolean
 start (GstBaseSink *sink)
 {
+  MarsCallbackSink *self = MARS_CALLBACK_SINK (sink);
+
   g_debug ("Starting");
+  mars_counter_set (&self->stats.start_time, g_get_monotonic_time ());
+  self->position = 0;
 
   return TRUE;
 }
 
 
+static void
+call_batch (MarsCallbackSink *self)
+{
+  gint64 begin;
+
+  if (self->batch == NULL || gst_buffer_list_length (self->batch) == 0)
+    return;
+
+  begin = g_get_monotonic_time ();
+  self->batch_cb (self->batch, self->batch_cb_user_data);
+  mars_histogram_record (&self->stats.callback_time,
+                         (g_get_monotonic_time () - begin) * GST_USECOND);
+
+  gst_clear_buffer_list (&self->batch);
+  self->batch_duration = 0;
+}
+
+
+/* Calls the batch callback once the batch is long enough. */
+static void
+add_to_batch (MarsCallbackSink *self, GstBuffer *buffer, guint64 batch_time)
+{
+  if (self->batch == NULL)
+    self->batch = gst_buffer_list_new ();
+
+  gst_buffer_list_add (self->batch, gst_buffer_ref (buffer));
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    self->batch_duration += GST_BUFFER_DURATION (buffer);
+
+  if (self->batch_duration >= batch_time)
+    call_batch (self);
+}
+
+
+/* Everything done for a buffer except calling back. */
+static void
+add_buffer (MarsCallbackSink *self, GstBuffer *buffer)
+{
+  gsize size = gst_buffer_get_size (buffer);
+
+  if (self->buffer_list_cb != NULL && GST_BUFFER_OFFSET (buffer) == self->position) {
+    gst_buffer_list_add (self->buffers, gst_buffer_ref (buffer));
+  } else if (self->buffer_list_cb != NULL) {
+    /* Shares the memory, only the metadata is copied. */
+    GstBuffer *positioned = gst_buffer_copy (buffer);
+
+    GST_BUFFER_OFFSET (positioned) = self->position;
+    gst_buffer_list_add (self->buffers, positioned);
+  }
+
+  if (self->buffer_list_cb != NULL) {
+    self->memory_size += size;
+    self->position += size;
+  }
+
+  mars_counter_add (&self->stats.buffers, 1);
+  mars_counter_add (&self->stats.bytes, size);
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    mars_counter_add (&self->stats.buffer_time, GST_BUFFER_DURATION (buffer));
+}
+
+
+static void
+call_buffer (MarsCallbackSink *self, GstBuffer *buffer)
+{
+  gint64 begin = g_get_monotonic_time ();
+
+  self->buffer_cb (buffer, self->buffer_cb_user_data);
+  mars_histogram_record (&self->stats.callback_time,
+                         (g_get_monotonic_time () - begin) * GST_USECOND);
+}
+
+
+static void
+check_memory_limit (MarsCallbackSink *self)
+{
+  guint64 memory_limit = __atomic_load_n (&self->memory_limit, __ATOMIC_RELAXED);
+
+  if (memory_limit != 0 && self->memory_size > memory_limit)
+    spill_buffers (self, memory_limit);
+}
+
+
 static GstFlowReturn
 render (GstBaseSink *sink, GstBuffer *buffer)
 {
   MarsCallbackSink *self = MARS_CALLBACK_SINK (sink);
 
-  g_debug ("Rendering buffer: %d", gst_buffer_list_length (self->buffers) + 1);
-  gst_buffer_list_add (self->buffers, gst_buffer_ref (buffer));
+  add_buffer (self, buffer);
+  check_memory_limit (self);
 
   if (self->buffer_cb)
-    self->buffer_cb (buffer, self->buffer_cb_user_data);
+    call_buffer (self, buffer);
+
+  if (self->batch_cb)
+    add_to_batch (self, buffer, __atomic_load_n (&self->batch_time, __ATOMIC_RELAXED));
 
   return GST_FLOW_OK;
 }
 
 
+/*
+ * Takes the whole list at once. Without a batch time, the list is handed to
+ * the batch callback as it is.
+ */
+static GstFlowReturn
+render_list (GstBaseSink *sink, GstBufferList *buffers)
+{
+  MarsCallbackSink *self = MARS_CALLBACK_SINK (sink);
+  guint64 batch_time = __atomic_load_n (&self->batch_time, __ATOMIC_RELAXED);
+  guint length = gst_buffer_list_length (buffers);
+
+  for (guint i = 0; i < length; i++)
+    add_buffer (self, gst_buffer_list_get (buffers, i));
+
+  check_memory_limit (self);
+
+  if (self->buffer_cb) {
+    for (guint i = 0; i < length; i++)
+      call_buffer (self, gst_buffer_list_get (buffers, i));
+  }
+
+  if (self->batch_cb && batch_time == 0 && self->batch == NULL) {
+    self->batch = gst_buffer_list_ref (buffers);
+    call_batch (self);
+  } else if (self->batch_cb) {
+    for (guint i = 0; i < length; i++)
+      add_to_batch (self, gst_buffer_list_get (buffers, i), batch_time);
+  }
+
+  return GST_FLOW_OK;
+}
+
+
+/*
+ * Hands over the last batch with the end of the stream and follows the byte
+ * position like a file would.
+ */
+static gboolean
+event (GstBaseSink *sink, GstEvent *event)
+{
+  MarsCallbackSink *self = MARS_CALLBACK_SINK (sink);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && self->batch_cb) {
+    call_batch (self);
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+    const GstSegment *segment;
+
+    gst_event_parse_segment (event, &segment);
+
+    if (segment->format == GST_FORMAT_BYTES)
+      self->position = segment->start;
+  }
+
+  return GST_BASE_SINK_CLASS (mars_callback_sink_parent_class)->event (sink, event);
+}
+
+
 static gboolean
 stop (GstBaseSink *sink)
 {
   MarsCallbackSink *self = MARS_CALLBACK_SINK (sink);
+  gint64 start_time;
+
+  g_debug ("Stopping with buffers: %d",
+           self->spilled->len + gst_buffer_list_length (self->buffers));
+
+  start_time = mars_counter_exchange (&self->stats.start_time, 0);
 
-  g_debug ("Stopping with buffers: %d", gst_buffer_list_length (self->buffers));
+  if (start_time != 0)
+    mars_counter_add (&self->stats.elapsed_time, g_get_monotonic_time () - start_time);
 
-  if (self->buffer_list_cb)
+  if (self->batch_cb)
+    call_batch (self);
+
+  gst_clear_buffer_list (&self->batch);
+  self->batch_duration = 0;
+
+  if (self->buffer_list_cb && self->spilled->len > 0) {
+    g_autoptr (GstBufferList) buffers = restore_buffers (self);
+
+    /* A chunk missing its spilled start is not handed over. */
+    if (buffers != NULL)
+      self->buffer_list_cb (buffers, self->buffer_list_cb_user_data);
+  } else if (self->buffer_list_cb) {
     self->buffer_list_cb (self->buffers, self->buffer_list_cb_user_data);
+  }
 
   gst_buffer_list_remove (self->buffers, 0, gst_buffer_list_length (self->buffers));
+  self->memory_size = 0;
+  clear_spill (self);
 
   return TRUE;
 }
@@ -92,7 +576,13 @@ mars_callback_sink_finalize (GObject *object)
   if (self->buffer_list_cb_destroy != NULL)
     self->buffer_list_cb_destroy (self->buffer_list_cb_user_data);
 
+  if (self->batch_cb_destroy != NULL)
+    self->batch_cb_destroy (self->batch_cb_user_data);
+
   gst_clear_buffer_list (&self->buffers);
+  gst_clear_buffer_list (&self->batch);
+  clear_spill (self);
+  g_array_unref (self->spilled);
 
   G_OBJECT_CLASS (mars_callback_sink_parent_class)->finalize (object);
 }
@@ -106,9 +596,51 @@ mars_callback_sink_class_init (MarsCallbackSinkClass *klass)
   GstBaseSinkClass *sink_class = GST_BASE_SINK_CLASS (klass);
 
   object_class->finalize = mars_callback_sink_finalize;
+  object_class->set_property = mars_callback_sink_set_property;
+  object_class->get_property = mars_callback_sink_get_property;
+
+  /**
+   * MarsCallbackSink:stats:
+   *
+   * Extends `GstBase.BaseSink:stats` with `buffers`, `bytes` (#guint64),
+   * `buffer-time`, `callback-time-p50`, `callback-time-p90`,
+   * `callback-time-p99` (#GstClockTime) and `real-time-factor` (#gdouble).
+   * The callback time is measured around the buffer and batch callbacks.
+   */
+  g_object_class_override_property (object_class, PROP_STATS, "stats");
+
+  /**
+   * MarsCallbackSink:memory-limit:
+   *
+   * Bytes of aggregated buffers to keep in memory before spilling the oldest
+   * ones to disk. `0` keeps everything in memory.
+   */
+  props[PROP_MEMORY_LIMIT] =
+    g_param_spec_uint64 ("memory-limit", "", "",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READWRITE |
+                         G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_property (object_class, PROP_MEMORY_LIMIT, props[PROP_MEMORY_LIMIT]);
+
+  /**
+   * MarsCallbackSink:batch-time:
+   *
+   * Duration of the buffers to collect before calling the batch callback.
+   * `0` calls it for every buffer or buffer list from upstream.
+   */
+  props[PROP_BATCH_TIME] =
+    g_param_spec_uint64 ("batch-time", "", "",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READWRITE |
+                         G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_property (object_class, PROP_BATCH_TIME, props[PROP_BATCH_TIME]);
 
   sink_class->start = start;
   sink_class->render = render;
+  sink_class->render_list = render_list;
+  sink_class->event = event;
   sink_class->stop = stop;
 
   gst_element_class_add_static_pad_template (element_class, &sinktemplate);
@@ -125,6 +657,8 @@ static void
 mars_callback_sink_init (MarsCallbackSink *self)
 {
   self->buffers = gst_buffer_list_new ();
+  self->spilled = g_array_new (FALSE, FALSE, sizeof (SpilledBuffer));
+  self->spill_fd = -1;
 }
 
 
@@ -167,3 +701,30 @@ mars_callback_sink_set_buffer_list_callback (MarsCallbackSink      *self,
   self->buffer_list_cb_user_data = user_data;
   self->buffer_list_cb_destroy = destroy;
 }
+
+
+/**
+ * mars_callback_sink_set_batch_callback:
+ * @self: The sink
+ * @batch_cb: (scope notified) (closure user_data): Called with every batch
+ * @user_data: Data for @batch_cb
+ * @destroy: (destroy user_data): Frees @user_data
+ *
+ * Sets the function to call with every batch of buffers. See
+ * [property@Mars.CallbackSink:batch-time].
+ */
+void
+mars_callback_sink_set_batch_callback (MarsCallbackSink      *self,
+                                       MarsBufferListCallback batch_cb,
+                                       gpointer               user_data,
+                                       GDestroyNotify         destroy)
+{
+  g_return_if_fail (MARS_IS_CALLBACK_SINK (self));
+
+  if (self->batch_cb_destroy != NULL)
+    self->batch_cb_destroy (self->batch_cb_user_data);
+
+  self->batch_cb = batch_cb;
+  self->batch_cb_user_data = user_data;
+  self->batch_cb_destroy = destroy;
+}
@@ -26,5 +26,9 @@ void        mars_callback_sink_set_buffer_list_callback (MarsCallbackSink      *
                                                          MarsBufferListCallback buffer_list_cb,
                                                          gpointer               user_data,
                                                          GDestroyNotify         destroy);
+void        mars_callback_sink_set_batch_callback (MarsCallbackSink      *self,
+                                                   MarsBufferListCallback batch_cb,
+                                                   gpointer               user_data,
+                                                   GDestroyNotify         destroy);
 
 G_END_DECLS
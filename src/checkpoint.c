@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-checkpoint"
+
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+/*
+ * Remembers the last chunk written and where the input continues after it, so
+ * that a new chunker can pick up from there.
+ *
+ * Dropping silence moves the output timestamps back, so the input position
+ * of a chunk boundary is found from the running time at which the offset
+ * between the input and the output last changed.
+ */
+
+#define GROUP "Checkpoint"
+
+struct _MarsCheckpoint {
+  char       *path;
+
+  GMutex      lock;
+  GArray     *offsets;
+  GHashTable *held;
+  GHashTable *written;
+};
+
+typedef struct {
+  GstClockTime running_time;
+  GstClockTimeDiff offset;
+} Offset;
+
+
+MarsCheckpoint *
+mars_checkpoint_new (const char *path)
+{
+  MarsCheckpoint *self = g_new0 (MarsCheckpoint, 1);
+
+  self->path = g_strdup (path);
+  self->offsets = g_array_new (FALSE, FALSE, sizeof (Offset));
+  self->held = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  self->written = g_hash_table_new (NULL, NULL);
+  g_mutex_init (&self->lock);
+
+  return self;
+}
+
+
+void
+mars_checkpoint_free (MarsCheckpoint *self)
+{
+  g_array_unref (self->offsets);
+  g_hash_table_unref (self->held);
+  g_hash_table_unref (self->written);
+  g_mutex_clear (&self->lock);
+  g_free (self->path);
+  g_free (self);
+}
+
+
+gboolean
+mars_checkpoint_load (MarsCheckpoint *self, guint *index, GstClockTime *position)
+{
+  g_autoptr (GKeyFile) key_file = g_key_file_new ();
+  g_autoptr (GError) error = NULL;
+  guint64 last_index;
+  guint64 last_position;
+
+  if (!g_key_file_load_from_file (key_file, self->path, G_KEY_FILE_NONE, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Unable to load checkpoint %s: %s", self->path, error->message);
+
+    return FALSE;
+  }
+
+  last_index = g_key_file_get_uint64 (key_file, GROUP, "index", &error);
+
+  if (error == NULL)
+    last_position = g_key_file_get_uint64 (key_file, GROUP, "position", &error);
+
+  if (error != NULL) {
+    g_warning ("Unable to read checkpoint %s: %s", self->path, error->message);
+    return FALSE;
+  }
+
+  *index = last_index;
+  *position = last_position;
+
+  return TRUE;
+}
+
+
+/*
+ * Called for every output buffer with its running time and the input position
+ * it came from.
+ */
+void
+mars_checkpoint_track (MarsCheckpoint *self, GstClockTime running_time, GstClockTime position)
+{
+  Offset offset = { running_time, GST_CLOCK_DIFF (running_time, position) };
+
+  g_mutex_lock (&self->lock);
+
+  if (self->offsets->len == 0 ||
+      g_array_index (self->offsets, Offset, self->offsets->len - 1).offset != offset.offset)
+    g_array_append_val (self->offsets, offset);
+
+  g_mutex_unlock (&self->lock);
+}
+
+
+/* Maps an output running time back to the input and forgets older offsets. */
+GstClockTime
+mars_checkpoint_get_position (MarsCheckpoint *self, GstClockTime running_time)
+{
+  GstClockTime position = GST_CLOCK_TIME_NONE;
+  guint i;
+
+  g_mutex_lock (&self->lock);
+
+  for (i = self->offsets->len; i > 0; i--) {
+    Offset *offset = &g_array_index (self->offsets, Offset, i - 1);
+
+    if (offset->running_time <= running_time) {
+      position = MAX (0, (GstClockTimeDiff) running_time + offset->offset);
+      g_array_remove_range (self->offsets, 0, i - 1);
+      break;
+    }
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  return position;
+}
+
+
+/* Keeps the checkpoint of a chunk until it is committed as written. */
+void
+mars_checkpoint_hold (MarsCheckpoint *self, guint index, GstClockTime position)
+{
+  gboolean written;
+
+  g_mutex_lock (&self->lock);
+
+  written = g_hash_table_remove (self->written, GUINT_TO_POINTER (index));
+
+  if (!written)
+    g_hash_table_insert (self->held, GUINT_TO_POINTER (index),
+                         g_memdup2 (&position, sizeof (position)));
+
+  g_mutex_unlock (&self->lock);
+
+  if (written)
+    mars_checkpoint_save (self, index, position);
+}
+
+
+void
+mars_checkpoint_commit (MarsCheckpoint *self, guint index)
+{
+  GstClockTime position = GST_CLOCK_TIME_NONE;
+  GstClockTime *held;
+
+  g_mutex_lock (&self->lock);
+
+  held = g_hash_table_lookup (self->held, GUINT_TO_POINTER (index));
+
+  if (held != NULL) {
+    position = *held;
+    g_hash_table_remove (self->held, GUINT_TO_POINTER (index));
+  } else {
+    g_hash_table_add (self->written, GUINT_TO_POINTER (index));
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  if (position != GST_CLOCK_TIME_NONE)
+    mars_checkpoint_save (self, index, position);
+}
+
+
+/* Replaces the file atomically, so a crash leaves the previous checkpoint. */
+void
+mars_checkpoint_save (MarsCheckpoint *self, guint index, GstClockTime position)
+{
+  g_autoptr (GKeyFile) key_file = g_key_file_new ();
+  g_autoptr (GError) error = NULL;
+  g_autofree char *data = NULL;
+  gsize length;
+
+  if (!GST_CLOCK_TIME_IS_VALID (position))
+    return;
+
+  g_debug ("Saving checkpoint: %u at %" GST_TIME_FORMAT, index, GST_TIME_ARGS (position));
+
+  g_key_file_set_uint64 (key_file, GROUP, "index", index);
+  g_key_file_set_uint64 (key_file, GROUP, "position", position);
+  data = g_key_file_to_data (key_file, &length, NULL);
+
+  if (!g_file_set_contents_full (self->path, data, length,
+                                 G_FILE_SET_CONTENTS_CONSISTENT | G_FILE_SET_CONTENTS_DURABLE,
+                                 0644, &error))
+    g_warning ("Unable to save checkpoint %s: %s", self->path, error->message);
+}
+
+
+void
+mars_checkpoint_remove (MarsCheckpoint *self)
+{
+  if (g_unlink (self->path) != 0 && errno != ENOENT)
+    g_warning ("Unable to remove checkpoint %s: %s", self->path, g_strerror (errno));
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MarsCheckpoint MarsCheckpoint;
+
+MarsCheckpoint *mars_checkpoint_new (const char *path);
+void            mars_checkpoint_free (MarsCheckpoint *self);
+
+gboolean        mars_checkpoint_load (MarsCheckpoint *self, guint *index, GstClockTime *position);
+void            mars_checkpoint_track (MarsCheckpoint *self, GstClockTime running_time, GstClockTime position);
+GstClockTime    mars_checkpoint_get_position (MarsCheckpoint *self, GstClockTime running_time);
+void            mars_checkpoint_hold (MarsCheckpoint *self, guint index, GstClockTime position);
+void            mars_checkpoint_commit (MarsCheckpoint *self, guint index);
+void            mars_checkpoint_save (MarsCheckpoint *self, guint index, GstClockTime position);
+void            mars_checkpoint_remove (MarsCheckpoint *self);
+
+G_END_DECLS
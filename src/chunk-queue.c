@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-chunk-queue"
+
+#include "chunk-queue.h"
+
+/*
+ * Bounded queue of chunks between the streaming thread and the consumer. A
+ * full queue blocks the streaming thread, which stalls the pipeline until the
+ * consumer catches up. Once closed, pushing no longer blocks and popping
+ * returns the remaining chunks and then %NULL.
+ */
+
+struct _MarsChunkQueue {
+  guint     capacity;
+
+  GMutex    lock;
+  GCond     cond;
+  GQueue    chunks;
+  gboolean  closed;
+};
+
+
+MarsChunkQueue *
+mars_chunk_queue_new (guint capacity)
+{
+  MarsChunkQueue *self = g_new0 (MarsChunkQueue, 1);
+
+  self->capacity = capacity;
+  g_queue_init (&self->chunks);
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+
+  return self;
+}
+
+
+void
+mars_chunk_queue_free (MarsChunkQueue *self)
+{
+  g_queue_clear_full (&self->chunks, (GDestroyNotify) gst_buffer_list_unref);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_free (self);
+}
+
+
+/* Keeps a copy, since the sink reuses its list for the next chunk. */
+void
+mars_chunk_queue_push (MarsChunkQueue *self, GstBufferList *chunk)
+{
+  g_mutex_lock (&self->lock);
+
+  while (!self->closed && self->chunks.length >= self->capacity)
+    g_cond_wait (&self->cond, &self->lock);
+
+  g_queue_push_tail (&self->chunks, gst_buffer_list_copy (chunk));
+  g_cond_broadcast (&self->cond);
+
+  g_mutex_unlock (&self->lock);
+}
+
+
+static void
+on_cancelled (GCancellable *cancellable, MarsChunkQueue *self)
+{
+  g_mutex_lock (&self->lock);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+
+GstBufferList *
+mars_chunk_queue_pop (MarsChunkQueue *self, GCancellable *cancellable, GError **error)
+{
+  GstBufferList *chunk;
+  gulong handler_id = 0;
+
+  if (cancellable != NULL)
+    handler_id = g_cancellable_connect (cancellable, G_CALLBACK (on_cancelled), self, NULL);
+
+  g_mutex_lock (&self->lock);
+
+  while (!self->closed && self->chunks.length == 0 &&
+         !g_cancellable_is_cancelled (cancellable))
+    g_cond_wait (&self->cond, &self->lock);
+
+  if (self->chunks.length == 0 || g_cancellable_is_cancelled (cancellable))
+    chunk = NULL;
+  else
+    chunk = g_queue_pop_head (&self->chunks);
+
+  g_cond_broadcast (&self->cond);
+
+  g_mutex_unlock (&self->lock);
+
+  g_cancellable_disconnect (cancellable, handler_id);
+  g_cancellable_set_error_if_cancelled (cancellable, error);
+
+  return chunk;
+}
+
+
+void
+mars_chunk_queue_close (MarsChunkQueue *self)
+{
+  g_mutex_lock (&self->lock);
+  self->closed = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+
+void
+mars_chunk_queue_open (MarsChunkQueue *self)
+{
+  g_mutex_lock (&self->lock);
+  self->closed = FALSE;
+  g_mutex_unlock (&self->lock);
+}
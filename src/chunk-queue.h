@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MarsChunkQueue MarsChunkQueue;
+
+MarsChunkQueue *mars_chunk_queue_new (guint capacity);
+void            mars_chunk_queue_free (MarsChunkQueue *self);
+
+void            mars_chunk_queue_push (MarsChunkQueue *self, GstBufferList *chunk);
+GstBufferList  *mars_chunk_queue_pop (MarsChunkQueue *self, GCancellable *cancellable, GError **error);
+void            mars_chunk_queue_close (MarsChunkQueue *self);
+void            mars_chunk_queue_open (MarsChunkQueue *self);
+
+G_END_DECLS
@@ -9,9 +9,21 @@
 #define G_LOG_DOMAIN "mars-chunker"
 
 #include "chunker.h"
+#include "bytes-pool.h"
+#include "callback-sink.h"
+#include "checkpoint.h"
+#include "chunk-queue.h"
+#include "encoder-pool.h"
+#include "resample.h"
+#include "stats.h"
+#include "threads.h"
+#include "vad.h"
 
 #include <gst/gst.h>
 
+#include <math.h>
+#include <stdio.h>
+
 /**
  * MarsChunker:
  *
@@ -20,10 +32,39 @@
  * Use `mic` to read from microphone. [signal@Mars.Chunker::chunked] can be used
  * to signal chunking. [property@Mars.Chunker:playing] can be used to know if
  * the processing has finished for audio streams from files.
+ * [property@Mars.Chunker:encoders] can be used to encode the chunks of
+ * [property@Mars.Chunker:output] in parallel.
+ * With [property@Mars.Chunker:split-channels], every channel is chunked on its
+ * own and [signal@Mars.Chunker::channel-chunked] tells which one was chunked.
+ *
+ * [property@Mars.Chunker:detector] selects how pauses are found. The spectral
+ * detector also drops the non-speech audio instead of the silent audio.
+ *
+ * [property@Mars.Chunker:queues] splits the processing into more streaming
+ * threads. The thread capturing from the source and the other streaming
+ * threads can be named, pinned to CPUs and given a real-time priority.
+ *
+ * Without [property@Mars.Chunker:output], setting
+ * [property@Mars.Chunker:max-queued-chunks] lets the chunks be pulled with
+ * [method@Mars.Chunker.next_chunk] instead, and setting
+ * [property@Mars.Chunker:in-memory] hands them over with
+ * [signal@Mars.Chunker::chunk-ready].
+ *
+ * Long jobs reading from a file can set [property@Mars.Chunker:checkpoint] to
+ * resume after the last written chunk when they are started again.
+ *
+ * The silence properties can be changed while playing. With
+ * [property@Mars.Chunker:adaptive-threshold], the silence threshold follows the
+ * noise floor so that the chunks are close to
+ * [property@Mars.Chunker:target-chunk-time].
+ * [property@Mars.Chunker:stats] can be polled from any thread to monitor the
+ * processing.
  */
 
 enum {
   CHUNKED,
+  CHANNEL_CHUNKED,
+  CHUNK_READY,
   N_SIGNALS,
 };
 static guint signals[N_SIGNALS];
@@ -35,12 +76,30 @@ enum {
   PROP_OUTPUT,
   PROP_SINK,
   PROP_MUXER,
+  PROP_ENCODERS,
+  PROP_SPLIT_CHANNELS,
   PROP_RATE,
+  PROP_RESAMPLE_QUALITY,
   PROP_MAXIMUM_CHUNK_TIME,
   PROP_MINIMUM_SILENCE_TIME,
   PROP_SILENCE_HYSTERESIS,
   PROP_SILENCE_THRESHOLD,
+  PROP_DETECTOR,
+  PROP_ADAPTIVE_THRESHOLD,
+  PROP_TARGET_CHUNK_TIME,
+  PROP_CLOCK,
+  PROP_MAX_QUEUED_CHUNKS,
+  PROP_IN_MEMORY,
+  PROP_CHECKPOINT,
+  PROP_QUEUES,
+  PROP_CAPTURE_THREAD_NAME,
+  PROP_CAPTURE_CPUS,
+  PROP_CAPTURE_PRIORITY,
+  PROP_PROCESSING_THREAD_NAME,
+  PROP_PROCESSING_CPUS,
+  PROP_PROCESSING_PRIORITY,
   PROP_PLAYING,
+  PROP_STATS,
   PROP_LAST_PROP,
 };
 static GParamSpec *props[PROP_LAST_PROP];
@@ -53,20 +112,165 @@ struct _MarsChunker {
   char       *output;
   GstElement *sink;
   char       *muxer;
+  guint       encoders;
+  gboolean    split_channels;
   gint        rate;
+  gint        resample_quality;
   guint64     hysteresis;
   guint64     max_chunk_time;
   guint64     min_silence_time;
   gint        threshold;
+  MarsChunkerDetector detector;
+  gboolean    adaptive;
+  guint64     target_chunk_time;
+  GstClock   *clock;
+  guint       max_queued_chunks;
+  gboolean    in_memory;
+  char       *checkpoint;
+  MarsChunkerQueues queues;
+  char       *capture_thread_name;
+  char       *capture_cpus;
+  gint        capture_priority;
+  char       *processing_thread_name;
+  char       *processing_cpus;
+  gint        processing_priority;
   gboolean    playing;
 
+  /* Numbers the processing threads of the pipeline in their names. */
+  gint        n_threads;
+
+  /* Channels chunked with split channels, to average their output time. */
+  gint        n_channels;
+
+  GstElement *source;
+  GstElement *silence;
   GstElement *muxsink;
   GstElement *pipeline;
+
+  MarsEncoderPool *encoder_pool;
+  MarsChunkQueue  *chunk_queue;
+  MarsBytesPool   *bytes_pool;
+
+  /* Checkpoints, the positions are only touched by the streaming thread. */
+  MarsCheckpoint *checkpointer;
+  guint       chunk_index;
+  GstClockTime resume_position;
+  gboolean    resume_seeking;
+  GstClockTime input_position;
+  GstSegment  output_segment;
+
+  /* Spectral detector, only touched by the streaming thread. */
+  MarsVad    *vad;
+  guint64     non_speech_time;
+  guint64     squashed_time;
+  gboolean    squashing;
+
+  /* Adaptive threshold, only touched by the streaming thread. */
+  gdouble     noise_floor;
+  gdouble     margin;
+  guint64     since_split;
+  guint64     since_adjust;
+
+  /* Updated from the streaming threads without locking. */
+  struct {
+    MarsCounter   buffers;
+    MarsCounter   bytes;
+    MarsCounter   input_time;
+    MarsCounter   output_time;
+    MarsCounter   silences;
+    MarsCounter   chunks;
+    MarsCounter   chunk_time;
+    MarsCounter   max_chunk_time;
+    MarsCounter   dropped;
+    MarsCounter   play_time;
+    MarsCounter   elapsed_time;
+    MarsHistogram callback_time;
+  } stats;
 };
 
 G_DEFINE_TYPE (MarsChunker, mars_chunker, G_TYPE_OBJECT)
 
 
+GType
+mars_chunker_detector_get_type (void)
+{
+  static gsize type_id = 0;
+  static const GEnumValue values[] = {
+    { MARS_CHUNKER_DETECTOR_ENERGY, "MARS_CHUNKER_DETECTOR_ENERGY", "energy" },
+    { MARS_CHUNKER_DETECTOR_SPECTRAL, "MARS_CHUNKER_DETECTOR_SPECTRAL", "spectral" },
+    { 0, NULL, NULL },
+  };
+
+  if (g_once_init_enter (&type_id))
+    g_once_init_leave (&type_id, g_enum_register_static ("MarsChunkerDetector", values));
+
+  return type_id;
+}
+
+
+GType
+mars_chunker_queues_get_type (void)
+{
+  static gsize type_id = 0;
+  static const GFlagsValue values[] = {
+    { MARS_CHUNKER_QUEUE_NONE, "MARS_CHUNKER_QUEUE_NONE", "none" },
+    { MARS_CHUNKER_QUEUE_CAPTURE, "MARS_CHUNKER_QUEUE_CAPTURE", "capture" },
+    { MARS_CHUNKER_QUEUE_DECODE, "MARS_CHUNKER_QUEUE_DECODE", "decode" },
+    { MARS_CHUNKER_QUEUE_MUX, "MARS_CHUNKER_QUEUE_MUX", "mux" },
+    { 0, NULL, NULL },
+  };
+
+  if (g_once_init_enter (&type_id))
+    g_once_init_leave (&type_id, g_flags_register_static ("MarsChunkerQueues", values));
+
+  return type_id;
+}
+
+
+/* Sets the property on `removesilence` of the mixed stream or of every channel. */
+static void
+set_silence_property (MarsChunker *self, const char *name, const GValue *value)
+{
+  g_autoptr (GstIterator) iter = NULL;
+  GValue item = G_VALUE_INIT;
+
+  if (self->pipeline == NULL)
+    return;
+
+  iter = gst_bin_iterate_all_by_element_factory_name (GST_BIN (self->pipeline), "removesilence");
+
+  /* Channels are added from the streaming thread, so start over on changes. */
+  for (;;) {
+    GstIteratorResult result = gst_iterator_next (iter, &item);
+
+    if (result == GST_ITERATOR_OK) {
+      g_object_set_property (g_value_get_object (&item), name, value);
+      g_value_reset (&item);
+    } else if (result == GST_ITERATOR_RESYNC) {
+      gst_iterator_resync (iter);
+    } else {
+      break;
+    }
+  }
+
+  g_value_unset (&item);
+}
+
+
+static void
+set_threshold (MarsChunker *self, gint threshold)
+{
+  GValue value = G_VALUE_INIT;
+
+  g_atomic_int_set (&self->threshold, threshold);
+
+  g_value_init (&value, G_TYPE_INT);
+  g_value_set_int (&value, threshold);
+  set_silence_property (self, "threshold", &value);
+  g_value_unset (&value);
+}
+
+
 static void
 mars_chunker_set_property (GObject      *object,
                            guint         property_id,
@@ -91,20 +295,73 @@ mars_chunker_set_property (GObject      *object,
   case PROP_MUXER:
     self->muxer = g_value_dup_string (value);
     break;
+  case PROP_ENCODERS:
+    self->encoders = g_value_get_uint (value);
+    break;
+  case PROP_SPLIT_CHANNELS:
+    self->split_channels = g_value_get_boolean (value);
+    break;
   case PROP_RATE:
     self->rate = g_value_get_int (value);
     break;
+  case PROP_RESAMPLE_QUALITY:
+    self->resample_quality = g_value_get_int (value);
+    break;
   case PROP_MAXIMUM_CHUNK_TIME:
     self->max_chunk_time = g_value_get_uint64 (value);
     break;
   case PROP_MINIMUM_SILENCE_TIME:
-    self->min_silence_time = g_value_get_uint64 (value);
+    __atomic_store_n (&self->min_silence_time, g_value_get_uint64 (value), __ATOMIC_RELAXED);
+    set_silence_property (self, "minimum-silence-time", value);
     break;
   case PROP_SILENCE_HYSTERESIS:
-    self->hysteresis = g_value_get_uint64 (value);
+    __atomic_store_n (&self->hysteresis, g_value_get_uint64 (value), __ATOMIC_RELAXED);
+    set_silence_property (self, "hysteresis", value);
     break;
   case PROP_SILENCE_THRESHOLD:
-    self->threshold = g_value_get_int (value);
+    set_threshold (self, g_value_get_int (value));
+    break;
+  case PROP_DETECTOR:
+    self->detector = g_value_get_enum (value);
+    break;
+  case PROP_ADAPTIVE_THRESHOLD:
+    g_atomic_int_set (&self->adaptive, g_value_get_boolean (value));
+    break;
+  case PROP_TARGET_CHUNK_TIME:
+    __atomic_store_n (&self->target_chunk_time, g_value_get_uint64 (value), __ATOMIC_RELAXED);
+    break;
+  case PROP_CLOCK:
+    self->clock = g_value_dup_object (value);
+    break;
+  case PROP_MAX_QUEUED_CHUNKS:
+    self->max_queued_chunks = g_value_get_uint (value);
+    break;
+  case PROP_IN_MEMORY:
+    self->in_memory = g_value_get_boolean (value);
+    break;
+  case PROP_CHECKPOINT:
+    self->checkpoint = g_value_dup_string (value);
+    break;
+  case PROP_QUEUES:
+    self->queues = g_value_get_flags (value);
+    break;
+  case PROP_CAPTURE_THREAD_NAME:
+    self->capture_thread_name = g_value_dup_string (value);
+    break;
+  case PROP_CAPTURE_CPUS:
+    self->capture_cpus = g_value_dup_string (value);
+    break;
+  case PROP_CAPTURE_PRIORITY:
+    self->capture_priority = g_value_get_int (value);
+    break;
+  case PROP_PROCESSING_THREAD_NAME:
+    self->processing_thread_name = g_value_dup_string (value);
+    break;
+  case PROP_PROCESSING_CPUS:
+    self->processing_cpus = g_value_dup_string (value);
+    break;
+  case PROP_PROCESSING_PRIORITY:
+    self->processing_priority = g_value_get_int (value);
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -136,24 +393,78 @@ mars_chunker_get_property (GObject    *object,
   case PROP_MUXER:
     g_value_set_string (value, self->muxer);
     break;
+  case PROP_ENCODERS:
+    g_value_set_uint (value, self->encoders);
+    break;
+  case PROP_SPLIT_CHANNELS:
+    g_value_set_boolean (value, self->split_channels);
+    break;
   case PROP_RATE:
     g_value_set_int (value, self->rate);
     break;
+  case PROP_RESAMPLE_QUALITY:
+    g_value_set_int (value, self->resample_quality);
+    break;
   case PROP_MAXIMUM_CHUNK_TIME:
     g_value_set_uint64 (value, self->max_chunk_time);
     break;
   case PROP_MINIMUM_SILENCE_TIME:
-    g_value_set_uint64 (value, self->min_silence_time);
+    g_value_set_uint64 (value, __atomic_load_n (&self->min_silence_time, __ATOMIC_RELAXED));
     break;
   case PROP_SILENCE_HYSTERESIS:
-    g_value_set_uint64 (value, self->hysteresis);
+    g_value_set_uint64 (value, __atomic_load_n (&self->hysteresis, __ATOMIC_RELAXED));
     break;
   case PROP_SILENCE_THRESHOLD:
-    g_value_set_int (value, self->threshold);
+    g_value_set_int (value, g_atomic_int_get (&self->threshold));
+    break;
+  case PROP_DETECTOR:
+    g_value_set_enum (value, self->detector);
+    break;
+  case PROP_ADAPTIVE_THRESHOLD:
+    g_value_set_boolean (value, g_atomic_int_get (&self->adaptive));
+    break;
+  case PROP_TARGET_CHUNK_TIME:
+    g_value_set_uint64 (value, __atomic_load_n (&self->target_chunk_time, __ATOMIC_RELAXED));
+    break;
+  case PROP_CLOCK:
+    g_value_set_object (value, self->clock);
+    break;
+  case PROP_MAX_QUEUED_CHUNKS:
+    g_value_set_uint (value, self->max_queued_chunks);
+    break;
+  case PROP_IN_MEMORY:
+    g_value_set_boolean (value, self->in_memory);
+    break;
+  case PROP_CHECKPOINT:
+    g_value_set_string (value, self->checkpoint);
+    break;
+  case PROP_QUEUES:
+    g_value_set_flags (value, self->queues);
+    break;
+  case PROP_CAPTURE_THREAD_NAME:
+    g_value_set_string (value, self->capture_thread_name);
+    break;
+  case PROP_CAPTURE_CPUS:
+    g_value_set_string (value, self->capture_cpus);
+    break;
+  case PROP_CAPTURE_PRIORITY:
+    g_value_set_int (value, self->capture_priority);
+    break;
+  case PROP_PROCESSING_THREAD_NAME:
+    g_value_set_string (value, self->processing_thread_name);
+    break;
+  case PROP_PROCESSING_CPUS:
+    g_value_set_string (value, self->processing_cpus);
+    break;
+  case PROP_PROCESSING_PRIORITY:
+    g_value_set_int (value, self->processing_priority);
     break;
   case PROP_PLAYING:
     g_value_set_boolean (value, self->playing);
     break;
+  case PROP_STATS:
+    g_value_take_boxed (value, mars_chunker_get_stats (self));
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -161,26 +472,293 @@ mars_chunker_get_property (GObject    *object,
 
 
 static const char* PIPELINE_TEMPLATE =
-  "decodebin name=decodebin ! audioconvert "
-  "! removesilence silent=false squash=true remove=true hysteresis=%lu "
+  "decodebin name=decodebin ! %s audioconvert "
+  "! removesilence name=silence silent=false squash=true remove=true hysteresis=%lu "
+  "  minimum-silence-time=%lu threshold=%i ! "
+  "marsresample rate=%i quality=%i ! audioresample name=resample";
+
+static const char* CHANNELS_PIPELINE_TEMPLATE =
+  "decodebin name=decodebin ! %s audioconvert ! deinterleave name=deinterleave";
+
+static const char* DECODE_QUEUE = "queue name=decode_queue ! ";
+
+static const char* CHANNEL_TEMPLATE =
+  "queue ! audioconvert "
+  "! removesilence name=silence_%u silent=false squash=true remove=true hysteresis=%lu "
   "  minimum-silence-time=%lu threshold=%i ! "
-  "audioresample name=resample";
+  "marsresample rate=%i quality=%i ! audioresample ! capsfilter caps=audio/x-raw,rate=%i";
+
+
+static void add_input_probe (MarsChunker *self, GstElement *element);
+static void add_output_probe (MarsChunker *self, GstElement *silence);
+
+
+static void
+on_chunk_written (guint index, MarsChunker *self)
+{
+  mars_checkpoint_commit (self->checkpointer, index);
+}
+
+
+static void
+on_raw_chunk (GstBufferList *buffers, MarsChunker *self)
+{
+  mars_encoder_pool_push (self->encoder_pool, buffers);
+}
+
+
+static GstPadProbeReturn
+on_raw_caps (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  mars_encoder_pool_set_caps (self->encoder_pool, caps);
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/*
+ * Lets splitmuxsink only split the raw stream and hands every chunk to the
+ * encoder pool instead of muxing it on the streaming thread.
+ */
+static GstElement *
+create_encoder_sink (MarsChunker *self, GstElement *resample)
+{
+  g_autoptr (GstPad) srcpad = NULL;
+  GstElement *sink;
+  guint n_workers;
+
+  n_workers = self->encoders != 0 ? self->encoders : g_get_num_processors ();
+  self->encoder_pool = mars_encoder_pool_new (self->muxer, self->output, n_workers);
+
+  srcpad = gst_element_get_static_pad (resample, "src");
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                     (GstPadProbeCallback) on_raw_caps, self, NULL);
+
+  sink = mars_callback_sink_new ();
+  g_object_set (sink, "sync", FALSE, NULL);
+  mars_callback_sink_set_buffer_list_callback (MARS_CALLBACK_SINK (sink),
+                                               (MarsBufferListCallback) on_raw_chunk,
+                                               self, NULL);
+
+  return gst_element_factory_make_full ("splitmuxsink",
+                                        "name", "muxsink",
+                                        "sink", sink,
+                                        "max-size-time", self->max_chunk_time,
+                                        "muxer-factory", "identity",
+                                        NULL);
+}
+
+
+/*
+ * Muxers that go back to rewrite their header leave the buffers out of order,
+ * so such chunks are put together into a single buffer.
+ */
+static void
+on_queued_chunk (GstBufferList *buffers, MarsChunker *self)
+{
+  g_autoptr (GstBufferList) chunk = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+
+  if (mars_bytes_pool_is_sequential (buffers)) {
+    mars_chunk_queue_push (self->chunk_queue, buffers);
+    return;
+  }
+
+  bytes = mars_bytes_pool_collect (self->bytes_pool, buffers);
+  chunk = gst_buffer_list_new_sized (1);
+  gst_buffer_list_add (chunk, gst_buffer_new_wrapped_bytes (bytes));
+
+  mars_chunk_queue_push (self->chunk_queue, chunk);
+}
+
+
+/*
+ * Muxes into a callback sink that queues the chunks for
+ * mars_chunker_next_chunk(). A full queue blocks the muxing thread.
+ */
+static GstElement *
+create_queue_sink (MarsChunker *self)
+{
+  GstElement *sink;
+
+  self->chunk_queue = mars_chunk_queue_new (self->max_queued_chunks);
+  self->bytes_pool = mars_bytes_pool_new (self->max_queued_chunks + 1);
+
+  sink = mars_callback_sink_new ();
+  g_object_set (sink, "sync", FALSE, NULL);
+  mars_callback_sink_set_buffer_list_callback (MARS_CALLBACK_SINK (sink),
+                                               (MarsBufferListCallback) on_queued_chunk,
+                                               self, NULL);
+
+  return gst_element_factory_make_full ("splitmuxsink",
+                                        "name", "muxsink",
+                                        "sink", sink,
+                                        "max-size-time", self->max_chunk_time,
+                                        "muxer-factory", self->muxer,
+                                        NULL);
+}
+
+
+/* Chunks the consumer may hold before the memory is allocated again. */
+#define BYTES_POOL_SIZE 4
+
+
+static void
+on_memory_chunk (GstBufferList *buffers, MarsChunker *self)
+{
+  g_autoptr (GBytes) bytes = mars_bytes_pool_collect (self->bytes_pool, buffers);
+
+  g_signal_emit (self, signals[CHUNK_READY], 0, bytes);
+}
+
+
+/*
+ * Muxes into a callback sink that joins every chunk into pooled memory, so
+ * nothing is written to the disk.
+ */
+static GstElement *
+create_memory_sink (MarsChunker *self)
+{
+  GstElement *sink;
+
+  self->bytes_pool = mars_bytes_pool_new (BYTES_POOL_SIZE);
+
+  sink = mars_callback_sink_new ();
+  g_object_set (sink, "sync", FALSE, NULL);
+  mars_callback_sink_set_buffer_list_callback (MARS_CALLBACK_SINK (sink),
+                                               (MarsBufferListCallback) on_memory_chunk,
+                                               self, NULL);
+
+  return gst_element_factory_make_full ("splitmuxsink",
+                                        "name", "muxsink",
+                                        "sink", sink,
+                                        "max-size-time", self->max_chunk_time,
+                                        "muxer-factory", self->muxer,
+                                        NULL);
+}
+
+
+/* Prefixes the file name of `MarsChunker:output` with the channel. */
+static char *
+get_channel_location (MarsChunker *self, guint channel)
+{
+  g_autofree char *dirname = g_path_get_dirname (self->output);
+  g_autofree char *basename = g_path_get_basename (self->output);
+  g_autofree char *filename = g_strdup_printf ("%u-%s", channel, basename);
+
+  return g_build_filename (dirname, filename, NULL);
+}
+
+
+static void
+on_channel_added (GstElement *deinterleave, GstPad *pad, MarsChunker *self)
+{
+  g_autofree char *parse_desc = NULL;
+  g_autofree char *silence_name = NULL;
+  g_autofree char *muxsink_name = NULL;
+  g_autofree char *location = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GstElement) silence = NULL;
+  g_autoptr (GstPad) sinkpad = NULL;
+  GstElement *bin;
+  GstElement *splitmuxsink;
+  guint channel;
+
+  if (sscanf (GST_PAD_NAME (pad), "src_%u", &channel) != 1)
+    return;
+
+  g_debug ("Adding channel: %u", channel);
+
+  parse_desc = g_strdup_printf (CHANNEL_TEMPLATE,
+                                channel, __atomic_load_n (&self->hysteresis, __ATOMIC_RELAXED),
+                                __atomic_load_n (&self->min_silence_time, __ATOMIC_RELAXED),
+                                g_atomic_int_get (&self->threshold),
+                                self->rate, self->resample_quality, self->rate);
+  bin = gst_parse_bin_from_description (parse_desc, TRUE, &error);
+
+  if (bin == NULL) {
+    g_critical ("Unable to create channel %u: %s", channel, error->message);
+    return;
+  }
+
+  muxsink_name = g_strdup_printf ("muxsink_%u", channel);
+  location = get_channel_location (self, channel);
+  splitmuxsink = gst_element_factory_make_full ("splitmuxsink",
+                                                "name", muxsink_name,
+                                                "location", location,
+                                                "max-size-time", self->max_chunk_time,
+                                                "muxer-factory", self->muxer,
+                                                NULL);
+
+  gst_bin_add_many (GST_BIN (self->pipeline), bin, splitmuxsink, NULL);
+
+  if (!gst_element_link (bin, splitmuxsink)) {
+    g_critical ("Unable to link channel %u and splitmuxsink", channel);
+    return;
+  }
+
+  sinkpad = gst_element_get_static_pad (bin, "sink");
+
+  if (gst_pad_link (pad, sinkpad) != GST_PAD_LINK_OK) {
+    g_critical ("Unable to link deinterleave and channel %u", channel);
+    return;
+  }
+
+  silence_name = g_strdup_printf ("silence_%u", channel);
+  silence = gst_bin_get_by_name (GST_BIN (bin), silence_name);
+  add_output_probe (self, silence);
+  g_atomic_int_inc (&self->n_channels);
+
+  gst_element_sync_state_with_parent (splitmuxsink);
+  gst_element_sync_state_with_parent (bin);
+}
 
 
 static GstElement *
 create_pipeline (MarsChunker *self)
 {
   gboolean using_mic;
-  g_autofree char *parse_desc;
+  g_autofree char *parse_desc = NULL;
   g_autoptr (GError) error = NULL;
   g_autoptr (GstElement) decodebin = NULL;
   g_autoptr (GstElement) resample = NULL;
   g_autoptr (GstCaps) caps = NULL;
+  const char *decode_queue;
   GstElement *src;
   GstElement *splitmuxsink;
   GstElement *pipeline;
 
+  if (self->split_channels && self->output == NULL) {
+    g_critical ("Unable to split channels without output");
+    return NULL;
+  }
+
+  if (self->max_queued_chunks != 0 && (self->output != NULL || self->sink != NULL)) {
+    g_critical ("Unable to queue chunks with output or sink");
+    return NULL;
+  }
+
+  if (self->in_memory &&
+      (self->output != NULL || self->sink != NULL || self->max_queued_chunks != 0)) {
+    g_critical ("Unable to chunk in memory with output, sink or queued chunks");
+    return NULL;
+  }
+
+  if (self->in_memory && self->encoders != 1) {
+    g_critical ("Unable to chunk in memory with encoders");
+    return NULL;
+  }
+
   using_mic = g_strcmp0 (self->input, MARS_CHUNKER_INPUT_MIC) == 0;
+  g_atomic_int_set (&self->n_threads, 0);
+  g_atomic_int_set (&self->n_channels, 0);
 
   if (self->src != NULL)
     src = self->src;
@@ -189,10 +767,17 @@ create_pipeline (MarsChunker *self)
   else
     src = gst_element_factory_make_full ("filesrc", "location", self->input, NULL);
 
-  parse_desc = g_strdup_printf (PIPELINE_TEMPLATE,
-                                self->hysteresis,
-                                self->min_silence_time, self->threshold,
-                                NULL);
+  decode_queue = self->queues & MARS_CHUNKER_QUEUE_DECODE ? DECODE_QUEUE : "";
+
+  if (self->split_channels)
+    parse_desc = g_strdup_printf (CHANNELS_PIPELINE_TEMPLATE, decode_queue);
+  else
+    parse_desc = g_strdup_printf (PIPELINE_TEMPLATE,
+                                  decode_queue,
+                                  __atomic_load_n (&self->hysteresis, __ATOMIC_RELAXED),
+                                  __atomic_load_n (&self->min_silence_time, __ATOMIC_RELAXED),
+                                  g_atomic_int_get (&self->threshold),
+                                  self->rate, self->resample_quality);
 
   pipeline = gst_parse_launch (parse_desc, &error);
 
@@ -210,14 +795,46 @@ create_pipeline (MarsChunker *self)
     return NULL;
   }
 
+  self->source = src;
   decodebin = gst_bin_get_by_name (GST_BIN (pipeline), "decodebin");
 
+  if (self->queues & MARS_CHUNKER_QUEUE_CAPTURE) {
+    GstElement *queue = gst_element_factory_make ("queue", "capture_queue");
+
+    gst_bin_add (GST_BIN (pipeline), queue);
+    src = queue;
+
+    if (!gst_element_link (self->source, queue)) {
+      g_critical ("Unable to link source and queue");
+      return NULL;
+    }
+  }
+
   if (!gst_element_link (src, decodebin)) {
     g_critical ("Unable to link source and decodebin");
     return NULL;
   }
 
-  if (self->output) {
+  /* The branches are added once the channels are known. */
+  if (self->split_channels) {
+    g_autoptr (GstElement) deinterleave = NULL;
+
+    deinterleave = gst_bin_get_by_name (GST_BIN (pipeline), "deinterleave");
+    add_input_probe (self, deinterleave);
+    g_signal_connect (deinterleave, "pad-added", G_CALLBACK (on_channel_added), self);
+
+    return pipeline;
+  }
+
+  resample = gst_bin_get_by_name (GST_BIN (pipeline), "resample");
+
+  if (self->max_queued_chunks != 0) {
+    splitmuxsink = create_queue_sink (self);
+  } else if (self->in_memory) {
+    splitmuxsink = create_memory_sink (self);
+  } else if (self->output && self->encoders != 1) {
+    splitmuxsink = create_encoder_sink (self, resample);
+  } else if (self->output) {
     splitmuxsink = gst_element_factory_make_full ("splitmuxsink",
                                                   "name", "muxsink",
                                                   "location", self->output,
@@ -238,9 +855,27 @@ create_pipeline (MarsChunker *self)
     return NULL;
   }
 
-  resample = gst_bin_get_by_name (GST_BIN (pipeline), "resample");
   caps = gst_caps_new_simple ("audio/x-raw", "rate", G_TYPE_INT, self->rate, NULL);
 
+  if (self->queues & MARS_CHUNKER_QUEUE_MUX) {
+    GstElement *queue = gst_element_factory_make_full ("queue",
+                                                       "name", "mux_queue",
+                                                       "max-size-time", 100 * GST_MSECOND,
+                                                       "max-size-buffers", 0,
+                                                       "max-size-bytes", 0,
+                                                       NULL);
+
+    gst_bin_add (GST_BIN (pipeline), queue);
+
+    if (!gst_element_link (resample, queue)) {
+      g_critical ("Unable to link audioresample and queue");
+      return NULL;
+    }
+
+    g_clear_object (&resample);
+    resample = gst_object_ref (queue);
+  }
+
   if (!gst_element_link_filtered (resample, splitmuxsink, caps)) {
     g_critical ("Unable to link audioresample and splitmuxsink");
     return NULL;
@@ -250,23 +885,573 @@ create_pipeline (MarsChunker *self)
 }
 
 
+/*
+ * removesilence drops everything under the threshold, so the margin stays
+ * well below speech levels to keep quiet speech in the chunks.
+ */
+#define ADAPTIVE_MARGIN 10.0
+#define ADAPTIVE_MAX_MARGIN 15.0
+#define ADAPTIVE_STEP 1.0
+#define ADAPTIVE_MIN_THRESHOLD -90
+#define ADAPTIVE_MAX_THRESHOLD -10
+
+
+/* Level of a buffer of `removesilence`, which only takes 16 bit samples. */
+static gdouble
+get_level (GstBuffer *buffer)
+{
+  GstMapInfo info;
+  const gint16 *samples;
+  gsize n_samples;
+  gdouble sum = 0;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
+    return -120;
+
+  samples = (const gint16 *) info.data;
+  n_samples = info.size / sizeof (gint16);
+
+  for (gsize i = 0; i < n_samples; i++)
+    sum += (gdouble) samples[i] * samples[i];
+
+  gst_buffer_unmap (buffer, &info);
+
+  if (n_samples == 0 || sum == 0)
+    return -120;
+
+  return MAX (-120, 10 * log10 (sum / n_samples / ((gdouble) G_MAXINT16 * G_MAXINT16)));
+}
+
+
+static void
+update_threshold (MarsChunker *self)
+{
+  gint threshold;
+
+  threshold = (gint) round (self->noise_floor + self->margin);
+  threshold = CLAMP (threshold, ADAPTIVE_MIN_THRESHOLD, ADAPTIVE_MAX_THRESHOLD);
+
+  if (threshold == g_atomic_int_get (&self->threshold))
+    return;
+
+  g_debug ("Adapting threshold: %d", threshold);
+  set_threshold (self, threshold);
+}
+
+
+/*
+ * Tracks the noise floor, falling quickly to quieter levels and rising slowly
+ * with louder ones. The threshold is raised above it while no chunk is made
+ * for too long, so that the next pause splits.
+ */
+static void
+adapt_to_buffer (MarsChunker *self, GstBuffer *buffer)
+{
+  guint64 target = __atomic_load_n (&self->target_chunk_time, __ATOMIC_RELAXED);
+  gdouble level = get_level (buffer);
+
+  if (isnan (self->noise_floor))
+    self->noise_floor = level;
+  else if (level < self->noise_floor)
+    self->noise_floor += 0.1 * (level - self->noise_floor);
+  else
+    self->noise_floor += 0.001 * (level - self->noise_floor);
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer)) {
+    self->since_split += GST_BUFFER_DURATION (buffer);
+    self->since_adjust += GST_BUFFER_DURATION (buffer);
+  }
+
+  if (target != 0 && self->since_split > target && self->since_adjust > target) {
+    self->margin = MIN (self->margin + ADAPTIVE_STEP, ADAPTIVE_MAX_MARGIN);
+    self->since_adjust = 0;
+  }
+
+  update_threshold (self);
+}
+
+
+/* Lowers the threshold when the chunks get much shorter than the target. */
+static void
+adapt_to_split (MarsChunker *self)
+{
+  guint64 target = __atomic_load_n (&self->target_chunk_time, __ATOMIC_RELAXED);
+
+  if (target != 0 && self->since_split < target / 2)
+    self->margin = MAX (self->margin - ADAPTIVE_STEP, 0);
+
+  self->since_split = 0;
+  self->since_adjust = 0;
+  update_threshold (self);
+}
+
+
+static gboolean
+is_adaptive (MarsChunker *self)
+{
+  return g_atomic_int_get (&self->adaptive) &&
+         !self->split_channels &&
+         self->detector == MARS_CHUNKER_DETECTOR_ENERGY;
+}
+
+
+static GstPadProbeReturn
+on_input_buffer (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  mars_counter_add (&self->stats.buffers, 1);
+  mars_counter_add (&self->stats.bytes, gst_buffer_get_size (buffer));
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    mars_counter_add (&self->stats.input_time, GST_BUFFER_DURATION (buffer));
+
+  if (is_adaptive (self))
+    adapt_to_buffer (self, buffer);
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+static GstPadProbeReturn
+on_output_buffer (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    mars_counter_add (&self->stats.output_time, GST_BUFFER_DURATION (buffer));
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* With split channels, the input is counted once before it is split. */
+static void
+add_input_probe (MarsChunker *self, GstElement *element)
+{
+  g_autoptr (GstPad) sinkpad = gst_element_get_static_pad (element, "sink");
+
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+                     (GstPadProbeCallback) on_input_buffer, self, NULL);
+}
+
+
+static void
+add_output_probe (MarsChunker *self, GstElement *silence)
+{
+  g_autoptr (GstPad) srcpad = gst_element_get_static_pad (silence, "src");
+
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+                     (GstPadProbeCallback) on_output_buffer, self, NULL);
+}
+
+
+static void
+add_stats_probes (MarsChunker *self, GstElement *silence)
+{
+  add_input_probe (self, silence);
+  add_output_probe (self, silence);
+}
+
+
+static void
+seek_to_checkpoint (GstElement *pipeline, MarsChunker *self)
+{
+  if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+                                GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                                self->resume_position))
+    g_debug ("Unable to seek, decoding up to the checkpoint");
+}
+
+
+/*
+ * Drops the input before the checkpoint. The first buffer asks for a seek,
+ * and if the input cannot seek, it is decoded and dropped up to there.
+ */
+static GstPadProbeReturn
+on_resume_buffer (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime end;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_REMOVE;
+
+  end = GST_BUFFER_PTS (buffer);
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    end += GST_BUFFER_DURATION (buffer);
+
+  if (end > self->resume_position) {
+    g_debug ("Resuming at %" GST_TIME_FORMAT, GST_TIME_ARGS (GST_BUFFER_PTS (buffer)));
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  if (!self->resume_seeking) {
+    self->resume_seeking = TRUE;
+    gst_element_call_async (self->pipeline,
+                            (GstElementCallAsyncFunc) seek_to_checkpoint, self, NULL);
+  }
+
+  return GST_PAD_PROBE_DROP;
+}
+
+
+static GstPadProbeReturn
+on_checkpoint_input (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  self->input_position = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+static GstPadProbeReturn
+on_checkpoint_output (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  GstBuffer *buffer;
+  GstClockTime running_time;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &self->output_segment);
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) || !GST_CLOCK_TIME_IS_VALID (self->input_position))
+    return GST_PAD_PROBE_OK;
+
+  running_time = gst_segment_to_running_time (&self->output_segment, GST_FORMAT_TIME,
+                                              GST_BUFFER_PTS (buffer));
+
+  if (GST_CLOCK_TIME_IS_VALID (running_time))
+    mars_checkpoint_track (self->checkpointer, running_time, self->input_position);
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/*
+ * Loads the checkpoint and continues the numbering after its chunk. It has to
+ * run before the other probes, so that they never see the skipped input.
+ */
+static void
+add_checkpoint_probes (MarsChunker *self)
+{
+  g_autoptr (GstPad) sinkpad = NULL;
+  g_autoptr (GstPad) srcpad = NULL;
+  guint index;
+
+  if (self->split_channels || self->silence == NULL) {
+    g_warning ("Checkpoints are not supported with split channels");
+    return;
+  }
+
+  if (g_strcmp0 (self->input, MARS_CHUNKER_INPUT_MIC) == 0) {
+    g_warning ("Checkpoints are not supported with microphone");
+    return;
+  }
+
+  self->checkpointer = mars_checkpoint_new (self->checkpoint);
+
+  if (self->encoder_pool != NULL)
+    mars_encoder_pool_set_written_func (self->encoder_pool,
+                                        (MarsEncoderPoolWrittenFunc) on_chunk_written, self);
+
+  self->input_position = GST_CLOCK_TIME_NONE;
+  gst_segment_init (&self->output_segment, GST_FORMAT_TIME);
+  sinkpad = gst_element_get_static_pad (self->silence, "sink");
+
+  if (mars_checkpoint_load (self->checkpointer, &index, &self->resume_position)) {
+    g_debug ("Resuming after chunk %u at %" GST_TIME_FORMAT,
+             index, GST_TIME_ARGS (self->resume_position));
+
+    self->chunk_index = index + 1;
+    g_object_set (self->muxsink, "start-index", self->chunk_index, NULL);
+
+    if (self->encoder_pool != NULL)
+      mars_encoder_pool_set_start_index (self->encoder_pool, self->chunk_index);
+
+    gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+                       (GstPadProbeCallback) on_resume_buffer, self, NULL);
+  }
+
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+                     (GstPadProbeCallback) on_checkpoint_input, self, NULL);
+
+  srcpad = gst_element_get_static_pad (self->silence, "src");
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                     (GstPadProbeCallback) on_checkpoint_output, self, NULL);
+}
+
+
+/* Records where the input continues after the chunk that was just closed. */
+static void
+save_checkpoint (MarsChunker *self, GstClockTime running_time)
+{
+  GstClockTime position;
+  guint index;
+
+  position = mars_checkpoint_get_position (self->checkpointer, running_time);
+  index = self->chunk_index++;
+
+  if (self->encoder_pool != NULL)
+    mars_checkpoint_hold (self->checkpointer, index, position);
+  else
+    mars_checkpoint_save (self->checkpointer, index, position);
+}
+
+
 static void
 on_eos (MarsChunker *self, GstMessage *message)
 {
   g_debug ("EOS reached");
   mars_chunker_stop (self);
+
+  /* Nothing is left to resume. */
+  if (self->checkpointer != NULL)
+    mars_checkpoint_remove (self->checkpointer);
+}
+
+
+static void
+on_error (MarsChunker *self, GstMessage *message)
+{
+  g_autoptr (GError) error;
+
+  gst_message_parse_error (message, &error, NULL);
+  g_critical ("%s: %s", GST_OBJECT_NAME (message->src), error->message);
+
+  mars_chunker_stop (self);
+}
+
+
+/*
+ * QoS messages carry the total dropped by their element so far, so every
+ * element remembers the last total and only the difference is counted.
+ */
+static void
+on_qos (MarsChunker *self, GstMessage *message)
+{
+  GObject *src = G_OBJECT (GST_MESSAGE_SRC (message));
+  guint64 *last_dropped;
+  guint64 dropped;
+
+  gst_message_parse_qos_stats (message, NULL, NULL, &dropped);
+
+  if (dropped == G_MAXUINT64)
+    return;
+
+  last_dropped = g_object_get_data (src, "mars-dropped");
+
+  if (last_dropped == NULL) {
+    last_dropped = g_new0 (guint64, 1);
+    g_object_set_data_full (src, "mars-dropped", last_dropped, g_free);
+  }
+
+  /* The total starts again when the element is restarted. */
+  if (dropped < *last_dropped)
+    *last_dropped = 0;
+
+  mars_counter_add (&self->stats.dropped, dropped - *last_dropped);
+  *last_dropped = dropped;
 }
 
 
-static void
-on_error (MarsChunker *self, GstMessage *message)
-{
-  g_autoptr (GError) error;
+/* Every splitmuxsink remembers when its current chunk was opened. */
+static void
+on_fragment (MarsChunker *self, GstMessage *message)
+{
+  const GstStructure *structure = gst_message_get_structure (message);
+  GObject *muxsink = G_OBJECT (GST_MESSAGE_SRC (message));
+  GstClockTime running_time;
+  GstClockTime chunk_time;
+  GstClockTime *chunk_start;
+
+  if (!gst_structure_get_clock_time (structure, "running-time", &running_time))
+    return;
+
+  if (gst_structure_has_name (structure, "splitmuxsink-fragment-opened")) {
+    g_object_set_data_full (muxsink, "mars-chunk-start",
+                            g_memdup2 (&running_time, sizeof (running_time)), g_free);
+    return;
+  }
+
+  if (self->checkpointer != NULL)
+    save_checkpoint (self, running_time);
+
+  chunk_start = g_object_get_data (muxsink, "mars-chunk-start");
+
+  if (chunk_start == NULL)
+    return;
+
+  chunk_time = running_time - *chunk_start;
+
+  mars_counter_add (&self->stats.chunks, 1);
+  mars_counter_add (&self->stats.chunk_time, chunk_time);
+  mars_counter_max (&self->stats.max_chunk_time, chunk_time);
+}
+
+
+static void
+split (MarsChunker *self)
+{
+  gint64 begin;
+
+  g_debug ("Chunking");
+  mars_counter_add (&self->stats.silences, 1);
+
+  if (is_adaptive (self))
+    adapt_to_split (self);
+
+  begin = g_get_monotonic_time ();
+
+  g_signal_emit_by_name (self->muxsink, "split-now", NULL);
+  g_signal_emit (self, signals[CHUNKED], 0);
+
+  mars_histogram_record (&self->stats.callback_time,
+                         (g_get_monotonic_time () - begin) * GST_USECOND);
+}
+
+
+static void
+on_caps (MarsChunker *self, GstEvent *event)
+{
+  const GstStructure *structure;
+  GstCaps *caps;
+  gint rate = 0;
+  gint channels = 1;
+
+  gst_event_parse_caps (event, &caps);
+  structure = gst_caps_get_structure (caps, 0);
+  gst_structure_get_int (structure, "rate", &rate);
+  gst_structure_get_int (structure, "channels", &channels);
+
+  if (rate > 0)
+    mars_vad_set_format (self->vad, rate, channels);
+}
+
+
+/*
+ * Runs the spectral detector before `removesilence`, which only passes the
+ * audio through then. Like `removesilence`, the pause is chunked once it is
+ * `MarsChunker:minimum-silence-time` long and the rest of it is dropped with
+ * the following timestamps moved back.
+ */
+static GstPadProbeReturn
+on_detector_data (GstPad *pad, GstPadProbeInfo *info, MarsChunker *self)
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gboolean speech;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+      on_caps (self, event);
+      break;
+    /* The timestamps start over, like after a checkpoint is sought. */
+    case GST_EVENT_STREAM_START:
+    case GST_EVENT_FLUSH_STOP:
+    case GST_EVENT_SEGMENT:
+      self->squashed_time = 0;
+      self->non_speech_time = 0;
+      self->squashing = FALSE;
+      break;
+    default:
+      break;
+    }
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+
+  speech = mars_vad_process (self->vad, (const gint16 *) map.data, map.size / sizeof (gint16));
+  gst_buffer_unmap (buffer, &map);
+
+  if (speech) {
+    self->non_speech_time = 0;
+    self->squashing = FALSE;
+  } else if (GST_BUFFER_DURATION_IS_VALID (buffer)) {
+    self->non_speech_time += GST_BUFFER_DURATION (buffer);
+
+    if (self->squashing) {
+      self->squashed_time += GST_BUFFER_DURATION (buffer);
+      return GST_PAD_PROBE_DROP;
+    }
+
+    if (self->non_speech_time >= __atomic_load_n (&self->min_silence_time, __ATOMIC_RELAXED)) {
+      self->squashing = TRUE;
+      split (self);
+    }
+  }
+
+  if (self->squashed_time != 0 && GST_BUFFER_PTS_IS_VALID (buffer)) {
+    buffer = gst_buffer_make_writable (buffer);
+    GST_BUFFER_PTS (buffer) -= MIN (self->squashed_time, GST_BUFFER_PTS (buffer));
+
+    if (GST_BUFFER_DTS_IS_VALID (buffer))
+      GST_BUFFER_DTS (buffer) -= MIN (self->squashed_time, GST_BUFFER_DTS (buffer));
+
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+static void
+add_detector_probe (MarsChunker *self)
+{
+  g_autoptr (GstPad) sinkpad = NULL;
+
+  g_object_set (self->silence, "remove", FALSE, "silent", TRUE, NULL);
+  self->vad = mars_vad_new ();
+
+  sinkpad = gst_element_get_static_pad (self->silence, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                     (GstPadProbeCallback) on_detector_data, self, NULL);
+}
+
+
+static void
+on_channel_message (MarsChunker *self, GstMessage *message)
+{
+  g_autofree char *muxsink_name = NULL;
+  g_autoptr (GstElement) muxsink = NULL;
+  guint channel;
+  gint64 begin;
+
+  if (sscanf (GST_OBJECT_NAME (GST_MESSAGE_SRC (message)), "silence_%u", &channel) != 1)
+    return;
+
+  muxsink_name = g_strdup_printf ("muxsink_%u", channel);
+  muxsink = gst_bin_get_by_name (GST_BIN (self->pipeline), muxsink_name);
+
+  if (muxsink == NULL)
+    return;
+
+  g_debug ("Chunking channel: %u", channel);
+  mars_counter_add (&self->stats.silences, 1);
+  begin = g_get_monotonic_time ();
 
-  gst_message_parse_error (message, &error, NULL);
-  g_critical ("%s: %s", GST_OBJECT_NAME (message->src), error->message);
+  g_signal_emit_by_name (muxsink, "split-now", NULL);
+  g_signal_emit (self, signals[CHUNKED], 0);
+  g_signal_emit (self, signals[CHANNEL_CHUNKED], 0, channel);
 
-  mars_chunker_stop (self);
+  mars_histogram_record (&self->stats.callback_time,
+                         (g_get_monotonic_time () - begin) * GST_USECOND);
 }
 
 
@@ -276,17 +1461,51 @@ on_message (MarsChunker *self, GstMessage *message)
   const GstStructure *structure;
   guint64 value;
 
-  if (!gst_message_has_name (message, "removesilence"))
+  structure = gst_message_get_structure (message);
+
+  if (gst_structure_has_name (structure, "splitmuxsink-fragment-opened") ||
+      gst_structure_has_name (structure, "splitmuxsink-fragment-closed")) {
+    on_fragment (self, message);
     return;
+  }
 
-  structure = gst_message_get_structure (message);
+  if (!gst_structure_has_name (structure, "removesilence"))
+    return;
 
   if (!gst_structure_get_uint64 (structure, "silence_detected", &value))
     return;
 
-  g_debug ("Chunking");
-  g_signal_emit_by_name (self->muxsink, "split-now", NULL);
-  g_signal_emit (self, signals[CHUNKED], 0);
+  if (self->split_channels)
+    on_channel_message (self, message);
+  else
+    split (self);
+}
+
+
+/* Streaming threads announce themselves from the thread, so they can be set up here. */
+static void
+on_stream_status (MarsChunker *self, GstMessage *message)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+  g_autofree char *name = NULL;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+
+  if (type != GST_STREAM_STATUS_TYPE_ENTER)
+    return;
+
+  if (gst_object_has_as_ancestor (GST_OBJECT (owner), GST_OBJECT (self->source))) {
+    g_debug ("Configuring capture thread of %s", GST_OBJECT_NAME (owner));
+    mars_thread_configure (self->capture_thread_name, self->capture_cpus, self->capture_priority);
+    return;
+  }
+
+  if (self->processing_thread_name != NULL)
+    name = g_strdup_printf ("%s%d", self->processing_thread_name, g_atomic_int_add (&self->n_threads, 1));
+
+  g_debug ("Configuring processing thread of %s", GST_OBJECT_NAME (owner));
+  mars_thread_configure (name, self->processing_cpus, self->processing_priority);
 }
 
 
@@ -300,8 +1519,17 @@ sync_message_handler (GstBus *bus, GstMessage *message, MarsChunker *self)
   case GST_MESSAGE_ERROR:
     on_error (self, message);
     break;
-  default:
+  case GST_MESSAGE_QOS:
+    on_qos (self, message);
+    break;
+  case GST_MESSAGE_STREAM_STATUS:
+    on_stream_status (self, message);
+    break;
+  case GST_MESSAGE_ELEMENT:
     on_message (self, message);
+    break;
+  default:
+    break;
   }
   return GST_BUS_PASS;
 }
@@ -312,8 +1540,10 @@ mars_chunker_dispose (GObject *object)
 {
   MarsChunker *self = MARS_CHUNKER (object);
 
+  g_clear_object (&self->silence);
   g_clear_object (&self->muxsink);
   g_clear_object (&self->pipeline);
+  g_clear_object (&self->clock);
 
   G_OBJECT_CLASS (mars_chunker_parent_class)->dispose (object);
 }
@@ -327,6 +1557,16 @@ mars_chunker_finalize (GObject *object)
   g_free (self->input);
   g_free (self->output);
   g_free (self->muxer);
+  g_free (self->checkpoint);
+  g_free (self->capture_thread_name);
+  g_free (self->capture_cpus);
+  g_free (self->processing_thread_name);
+  g_free (self->processing_cpus);
+  g_clear_pointer (&self->encoder_pool, mars_encoder_pool_free);
+  g_clear_pointer (&self->checkpointer, mars_checkpoint_free);
+  g_clear_pointer (&self->chunk_queue, mars_chunk_queue_free);
+  g_clear_pointer (&self->bytes_pool, mars_bytes_pool_unref);
+  g_clear_pointer (&self->vad, mars_vad_free);
 
   G_OBJECT_CLASS (mars_chunker_parent_class)->finalize (object);
 }
@@ -340,12 +1580,29 @@ mars_chunker_constructed (GObject *object)
 
   G_OBJECT_CLASS (mars_chunker_parent_class)->constructed (object);
 
+  /* Templates for mars_chunker_clone() have nothing to chunk. */
+  if (self->input == NULL && self->src == NULL)
+    return;
+
   self->pipeline = create_pipeline (self);
 
   if (self->pipeline == NULL)
     return;
 
+  if (self->clock != NULL)
+    gst_pipeline_use_clock (GST_PIPELINE (self->pipeline), self->clock);
+
+  self->silence = gst_bin_get_by_name (GST_BIN (self->pipeline), "silence");
   self->muxsink = gst_bin_get_by_name (GST_BIN (self->pipeline), "muxsink");
+
+  if (self->checkpoint != NULL)
+    add_checkpoint_probes (self);
+
+  if (self->silence != NULL)
+    add_stats_probes (self, self->silence);
+
+  if (self->silence != NULL && self->detector == MARS_CHUNKER_DETECTOR_SPECTRAL)
+    add_detector_probe (self);
   bus = gst_element_get_bus (self->pipeline);
   gst_bus_set_sync_handler (bus, (GstBusSyncHandler) sync_message_handler, self, NULL);
 }
@@ -424,6 +1681,36 @@ mars_chunker_class_init (MarsChunkerClass *klass)
                          G_PARAM_CONSTRUCT_ONLY |
                          G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MarsChunker:encoders:
+   *
+   * Number of threads encoding the chunks of `MarsChunker:output` with
+   * `MarsChunker:muxer` in parallel. `1` lets `Gst.splitmuxsink` encode them
+   * and `0` uses a thread per processor.
+   */
+  props[PROP_ENCODERS] =
+    g_param_spec_uint ("encoders", "", "",
+                       0, G_MAXINT, 1,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:split-channels:
+   *
+   * Whether to chunk every channel on its own. The chunks of a channel are
+   * saved in `MarsChunker:output` with the channel and a `-` prefixed to the
+   * file name, like `output/1-%02d.wav`.
+   * `MarsChunker:sink`, `MarsChunker:encoders` and
+   * `MarsChunker:adaptive-threshold` are not supported with it.
+   */
+  props[PROP_SPLIT_CHANNELS] =
+    g_param_spec_boolean ("split-channels", "", "",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+
   /**
    * MarsChunker:rate:
    *
@@ -436,6 +1723,20 @@ mars_chunker_class_init (MarsChunkerClass *klass)
                       G_PARAM_CONSTRUCT_ONLY |
                       G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MarsChunker:resample-quality:
+   *
+   * Quality of the built-in conversion from 44.1 and 48 kHz to 8 and 16 kHz,
+   * from `0` for the fastest to `10` for the best. Other rates are converted
+   * by `audioresample`.
+   */
+  props[PROP_RESAMPLE_QUALITY] =
+    g_param_spec_int ("resample-quality", "", "",
+                      0, 10, 4,
+                      G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT_ONLY |
+                      G_PARAM_STATIC_STRINGS);
+
   /**
    * MarsChunker:maximum-chunk-time:
    *
@@ -452,35 +1753,227 @@ mars_chunker_class_init (MarsChunkerClass *klass)
    * MarsChunker:minimum-silence-time:
    *
    * Proxy for `Gst.removesilence:minimum-silence-time`.
+   * Can be changed while playing.
    */
   props[PROP_MINIMUM_SILENCE_TIME] =
     g_param_spec_uint64 ("minimum-silence-time", "", "",
                          0, G_MAXUINT64, MARS_CHUNKER_MINIMUM_SILENCE_TIME,
                          G_PARAM_READWRITE |
-                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_CONSTRUCT |
                          G_PARAM_STATIC_STRINGS);
 
   /**
    * MarsChunker:silence-hysteresis:
    *
    * Proxy for `Gst.removesilence:hysteresis`.
+   * Can be changed while playing.
    */
   props[PROP_SILENCE_HYSTERESIS] =
     g_param_spec_uint64 ("silence-hysteresis", "", "",
                          0, G_MAXUINT64, MARS_CHUNKER_SILENCE_HYSTERESIS,
                          G_PARAM_READWRITE |
-                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_CONSTRUCT |
                          G_PARAM_STATIC_STRINGS);
 
   /**
    * MarsChunker:silence-threshold:
    *
    * Proxy for `Gst.removesilence:threshold`.
+   * Can be changed while playing and is updated by
+   * `MarsChunker:adaptive-threshold`.
    */
   props[PROP_SILENCE_THRESHOLD] =
     g_param_spec_int ("silence-threshold", "", "",
                       G_MININT, G_MAXINT, MARS_CHUNKER_SILENCE_THRESHOLD,
                       G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT |
+                      G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:detector:
+   *
+   * How pauses to chunk at are found. Only `energy` is supported with
+   * `MarsChunker:split-channels`.
+   */
+  props[PROP_DETECTOR] =
+    g_param_spec_enum ("detector", "", "",
+                       MARS_TYPE_CHUNKER_DETECTOR,
+                       MARS_CHUNKER_DETECTOR_ENERGY,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:adaptive-threshold:
+   *
+   * Whether to adjust `MarsChunker:silence-threshold` to the noise floor so
+   * that chunks stay close to `MarsChunker:target-chunk-time`. Only used by
+   * the `energy` detector and not with `MarsChunker:split-channels`, whose
+   * channels would share one noise floor.
+   */
+  props[PROP_ADAPTIVE_THRESHOLD] =
+    g_param_spec_boolean ("adaptive-threshold", "", "",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:target-chunk-time:
+   *
+   * Chunk length aimed at by `MarsChunker:adaptive-threshold`.
+   */
+  props[PROP_TARGET_CHUNK_TIME] =
+    g_param_spec_uint64 ("target-chunk-time", "", "",
+                         0, G_MAXUINT64, MARS_CHUNKER_TARGET_CHUNK_TIME,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:clock:
+   *
+   * Clock to use for the pipeline instead of the one it selects.
+   * Useful to drive live sources with a `GstCheck.TestClock`.
+   */
+  props[PROP_CLOCK] =
+    g_param_spec_object ("clock", "", "",
+                         GST_TYPE_CLOCK,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:max-queued-chunks:
+   *
+   * How many chunks to hold for [method@Mars.Chunker.next_chunk] before the
+   * processing waits for them to be pulled. `0` disables pulling. It cannot
+   * be used with [property@Mars.Chunker:output] or
+   * [property@Mars.Chunker:sink].
+   */
+  props[PROP_MAX_QUEUED_CHUNKS] =
+    g_param_spec_uint ("max-queued-chunks", "", "",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:in-memory:
+   *
+   * Whether to hand every muxed chunk over with
+   * [signal@Mars.Chunker::chunk-ready] instead of writing it. It cannot be
+   * used with [property@Mars.Chunker:output], [property@Mars.Chunker:sink]
+   * or [property@Mars.Chunker:max-queued-chunks], and the chunks are muxed on
+   * the streaming thread, so [property@Mars.Chunker:encoders] must stay `1`.
+   * [property@Mars.Chunker:split-channels] needs an output and is not
+   * supported either.
+   */
+  props[PROP_IN_MEMORY] =
+    g_param_spec_boolean ("in-memory", "", "",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:checkpoint:
+   *
+   * File to record the last written chunk and the input position after it
+   * in. If it exists, the input is sought there and the numbering continues
+   * after that chunk. It is removed once the input is fully chunked.
+   */
+  props[PROP_CHECKPOINT] =
+    g_param_spec_string ("checkpoint", "", "",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:queues:
+   *
+   * Where to add queues so that decoding, processing and muxing run in their
+   * own streaming threads.
+   */
+  props[PROP_QUEUES] =
+    g_param_spec_flags ("queues", "", "",
+                        MARS_TYPE_CHUNKER_QUEUES,
+                        MARS_CHUNKER_QUEUE_NONE,
+                        G_PARAM_READWRITE |
+                        G_PARAM_CONSTRUCT_ONLY |
+                        G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:capture-thread-name:
+   *
+   * Name of the streaming thread of the source, cut to 15 characters.
+   */
+  props[PROP_CAPTURE_THREAD_NAME] =
+    g_param_spec_string ("capture-thread-name", "", "",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:capture-cpus:
+   *
+   * CPUs to run the streaming thread of the source on, like `0-1,4`.
+   */
+  props[PROP_CAPTURE_CPUS] =
+    g_param_spec_string ("capture-cpus", "", "",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:capture-priority:
+   *
+   * Real-time (`SCHED_FIFO`) priority of the streaming thread of the source,
+   * if permitted. `0` keeps the default scheduling.
+   */
+  props[PROP_CAPTURE_PRIORITY] =
+    g_param_spec_int ("capture-priority", "", "",
+                      0, 99, 0,
+                      G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT_ONLY |
+                      G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:processing-thread-name:
+   *
+   * Prefix for the names of the other streaming threads, which are numbered.
+   */
+  props[PROP_PROCESSING_THREAD_NAME] =
+    g_param_spec_string ("processing-thread-name", "", "",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:processing-cpus:
+   *
+   * CPUs to run the other streaming threads on, like `2-3`.
+   */
+  props[PROP_PROCESSING_CPUS] =
+    g_param_spec_string ("processing-cpus", "", "",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsChunker:processing-priority:
+   *
+   * Real-time (`SCHED_FIFO`) priority of the other streaming threads, if
+   * permitted. `0` keeps the default scheduling.
+   */
+  props[PROP_PROCESSING_PRIORITY] =
+    g_param_spec_int ("processing-priority", "", "",
+                      0, 99, 0,
+                      G_PARAM_READWRITE |
                       G_PARAM_CONSTRUCT_ONLY |
                       G_PARAM_STATIC_STRINGS);
 
@@ -496,8 +1989,22 @@ mars_chunker_class_init (MarsChunkerClass *klass)
                           G_PARAM_EXPLICIT_NOTIFY |
                           G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MarsChunker:stats:
+   *
+   * Snapshot of the processing statistics.
+   * See [method@Mars.Chunker.get_stats] for the fields.
+   */
+  props[PROP_STATS] =
+    g_param_spec_boxed ("stats", "", "",
+                        GST_TYPE_STRUCTURE,
+                        G_PARAM_READABLE |
+                        G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, PROP_LAST_PROP, props);
 
+  mars_resample_register ();
+
   signals[CHUNKED] = g_signal_new ("chunked",
                                    G_OBJECT_CLASS_TYPE (object_class),
                                    G_SIGNAL_RUN_FIRST | G_SIGNAL_ACTION,
@@ -506,12 +2013,51 @@ mars_chunker_class_init (MarsChunkerClass *klass)
                                    NULL,
                                    G_TYPE_NONE,
                                    0);
+
+  /**
+   * MarsChunker::channel-chunked:
+   * @self: The chunker
+   * @channel: The channel that was chunked
+   *
+   * Emitted with [signal@Mars.Chunker::chunked] when
+   * [property@Mars.Chunker:split-channels] is set.
+   */
+  signals[CHANNEL_CHUNKED] = g_signal_new ("channel-chunked",
+                                           G_OBJECT_CLASS_TYPE (object_class),
+                                           G_SIGNAL_RUN_FIRST,
+                                           0,
+                                           NULL, NULL,
+                                           NULL,
+                                           G_TYPE_NONE,
+                                           1,
+                                           G_TYPE_UINT);
+
+  /**
+   * MarsChunker::chunk-ready:
+   * @self: The chunker
+   * @bytes: The muxed chunk
+   *
+   * Emitted from the streaming thread with every chunk when
+   * [property@Mars.Chunker:in-memory] is set. The memory of @bytes is reused
+   * for later chunks once every reference to it is dropped.
+   */
+  signals[CHUNK_READY] = g_signal_new ("chunk-ready",
+                                       G_OBJECT_CLASS_TYPE (object_class),
+                                       G_SIGNAL_RUN_LAST,
+                                       0,
+                                       NULL, NULL,
+                                       NULL,
+                                       G_TYPE_NONE,
+                                       1,
+                                       G_TYPE_BYTES);
 }
 
 
 static void
 mars_chunker_init (MarsChunker *self)
 {
+  self->noise_floor = NAN;
+  self->margin = ADAPTIVE_MARGIN;
 }
 
 
@@ -522,6 +2068,93 @@ mars_chunker_new (char *input, char *output, char *muxer)
 }
 
 
+/* Properties that belong to a single job rather than to the configuration. */
+static const char * const CLONE_SKIPPED[] = {
+  "input",
+  "output",
+  "src",
+  "sink",
+  "checkpoint",
+  "clock",
+  NULL,
+};
+
+
+static void
+add_string (GPtrArray *names, GArray *values, const char *name, const char *string)
+{
+  GValue value = G_VALUE_INIT;
+
+  g_value_init (&value, G_TYPE_STRING);
+  g_value_set_string (&value, string);
+
+  g_ptr_array_add (names, (gpointer) name);
+  g_array_append_val (values, value);
+}
+
+
+/**
+ * mars_chunker_clone:
+ * @self: The chunker to use as a template
+ * @input: The input of the new chunker
+ * @output: (nullable): The output of the new chunker
+ *
+ * Creates a chunker with the same configuration as @self, but for another
+ * input and output. A chunker without input or source builds no pipeline,
+ * so it can be kept as a template. The new chunker builds its own pipeline.
+ *
+ * The source, sink, clock and checkpoint are not copied, so that clones do
+ * not share them.
+ *
+ * Returns: (transfer full): The new chunker
+ */
+MarsChunker *
+mars_chunker_clone (MarsChunker *self, const char *input, const char *output)
+{
+  g_autofree GParamSpec **pspecs = NULL;
+  g_autoptr (GPtrArray) names = g_ptr_array_new ();
+  g_autoptr (GArray) values = g_array_new (FALSE, FALSE, sizeof (GValue));
+  guint n_pspecs;
+
+  g_return_val_if_fail (MARS_IS_CHUNKER (self), NULL);
+
+  g_array_set_clear_func (values, (GDestroyNotify) g_value_unset);
+  pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (self), &n_pspecs);
+
+  for (guint i = 0; i < n_pspecs; i++) {
+    GValue value = G_VALUE_INIT;
+
+    if ((pspecs[i]->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE ||
+        g_strv_contains (CLONE_SKIPPED, pspecs[i]->name))
+      continue;
+
+    g_value_init (&value, pspecs[i]->value_type);
+    g_object_get_property (G_OBJECT (self), pspecs[i]->name, &value);
+    g_ptr_array_add (names, (gpointer) pspecs[i]->name);
+    g_array_append_val (values, value);
+  }
+
+  add_string (names, values, "input", input);
+  add_string (names, values, "output", output);
+
+  return MARS_CHUNKER (g_object_new_with_properties (MARS_TYPE_CHUNKER, names->len,
+                                                     (const char **) names->pdata,
+                                                     (const GValue *) values->data));
+}
+
+
+static void
+update_elapsed_time (MarsChunker *self)
+{
+  gint64 play_time;
+
+  play_time = mars_counter_exchange (&self->stats.play_time, 0);
+
+  if (play_time != 0)
+    mars_counter_add (&self->stats.elapsed_time, g_get_monotonic_time () - play_time);
+}
+
+
 gboolean
 mars_chunker_is_playing (MarsChunker *self)
 {
@@ -539,6 +2172,11 @@ mars_chunker_play (MarsChunker *self)
   g_debug ("Starting playback");
   self->playing = TRUE;
 
+  if (self->chunk_queue != NULL)
+    mars_chunk_queue_open (self->chunk_queue);
+
+  mars_counter_set (&self->stats.play_time, g_get_monotonic_time ());
+
   gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_PLAYING]);
 }
@@ -551,6 +2189,7 @@ mars_chunker_pause (MarsChunker *self)
 
   g_debug ("Pausing playback");
   self->playing = FALSE;
+  update_elapsed_time (self);
 
   gst_element_set_state (self->pipeline, GST_STATE_PAUSED);
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_PLAYING]);
@@ -563,8 +2202,191 @@ mars_chunker_stop (MarsChunker *self)
   g_return_if_fail (MARS_IS_CHUNKER (self));
 
   g_debug ("Stopping playback");
-  self->playing = FALSE;
+  update_elapsed_time (self);
+
+  /* The last chunk must not wait for the consumer. */
+  if (self->chunk_queue != NULL)
+    mars_chunk_queue_close (self->chunk_queue);
 
   gst_element_set_state (self->pipeline, GST_STATE_NULL);
+
+  /* The last chunk is handed over while going to NULL. */
+  if (self->encoder_pool != NULL)
+    mars_encoder_pool_finish (self->encoder_pool);
+
+  self->playing = FALSE;
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_PLAYING]);
 }
+
+
+/**
+ * mars_chunker_get_stats:
+ * @self: The chunker
+ *
+ * Gets a snapshot of the processing statistics. It is safe to call from any
+ * thread and does not block the streaming threads.
+ *
+ * The structure has the fields `buffers`, `bytes`, `chunks`, `silences`,
+ * `dropped` (#guint64), `input-time`, `silence-squashed-time`,
+ * `average-chunk-length`, `max-chunk-length`, `callback-time-p50`,
+ * `callback-time-p90`, `callback-time-p99` (#GstClockTime),
+ * `real-time-factor` (#gdouble) and `silence-threshold` (#gint). The callback
+ * time is measured around [signal@Mars.Chunker::chunked] and the real-time
+ * factor is the wall-clock time spent playing divided by the audio time
+ * processed. With [property@Mars.Chunker:split-channels], the input is
+ * counted before it is split and the squashed time is averaged over the
+ * channels.
+ *
+ * Returns: (transfer full): The statistics
+ */
+GstStructure *
+mars_chunker_get_stats (MarsChunker *self)
+{
+  guint64 input_time;
+  guint64 output_time;
+  guint64 chunks;
+  guint64 elapsed_time;
+  guint64 play_time;
+  gdouble real_time_factor = 0;
+
+  g_return_val_if_fail (MARS_IS_CHUNKER (self), NULL);
+
+  input_time = mars_counter_get (&self->stats.input_time);
+  output_time = mars_counter_get (&self->stats.output_time);
+
+  if (g_atomic_int_get (&self->n_channels) > 1)
+    output_time /= g_atomic_int_get (&self->n_channels);
+  chunks = mars_counter_get (&self->stats.chunks);
+  elapsed_time = mars_counter_get (&self->stats.elapsed_time);
+  play_time = mars_counter_get (&self->stats.play_time);
+
+  if (play_time != 0)
+    elapsed_time += g_get_monotonic_time () - play_time;
+
+  if (input_time != 0)
+    real_time_factor = (gdouble) elapsed_time * GST_USECOND / input_time;
+
+  return gst_structure_new ("MarsChunkerStats",
+                            "buffers", G_TYPE_UINT64, mars_counter_get (&self->stats.buffers),
+                            "bytes", G_TYPE_UINT64, mars_counter_get (&self->stats.bytes),
+                            "chunks", G_TYPE_UINT64, chunks,
+                            "silences", G_TYPE_UINT64, mars_counter_get (&self->stats.silences),
+                            "dropped", G_TYPE_UINT64, mars_counter_get (&self->stats.dropped),
+                            "input-time", G_TYPE_UINT64, input_time,
+                            "silence-squashed-time", G_TYPE_UINT64,
+                            input_time > output_time ? input_time - output_time : 0,
+                            "average-chunk-length", G_TYPE_UINT64,
+                            chunks != 0 ? mars_counter_get (&self->stats.chunk_time) / chunks : 0,
+                            "max-chunk-length", G_TYPE_UINT64,
+                            mars_counter_get (&self->stats.max_chunk_time),
+                            "callback-time-p50", G_TYPE_UINT64,
+                            mars_histogram_percentile (&self->stats.callback_time, 50),
+                            "callback-time-p90", G_TYPE_UINT64,
+                            mars_histogram_percentile (&self->stats.callback_time, 90),
+                            "callback-time-p99", G_TYPE_UINT64,
+                            mars_histogram_percentile (&self->stats.callback_time, 99),
+                            "real-time-factor", G_TYPE_DOUBLE, real_time_factor,
+                            "silence-threshold", G_TYPE_INT, g_atomic_int_get (&self->threshold),
+                            NULL);
+}
+
+
+/**
+ * mars_chunker_next_chunk:
+ * @self: The chunker
+ * @cancellable: (nullable): A #GCancellable
+ * @error: Return location for an error
+ *
+ * Waits for the next muxed chunk. It needs
+ * [property@Mars.Chunker:max-queued-chunks]. The processing waits while that
+ * many chunks are not pulled.
+ *
+ * The buffers follow each other like in a file, so joining them gives the
+ * muxed chunk even when the muxer rewrote its header at the end.
+ *
+ * Returns: (transfer full) (nullable): The buffers of the chunk, or %NULL once
+ *   the chunker is stopped and every chunk is pulled, or on error
+ */
+GstBufferList *
+mars_chunker_next_chunk (MarsChunker  *self,
+                         GCancellable *cancellable,
+                         GError      **error)
+{
+  g_return_val_if_fail (MARS_IS_CHUNKER (self), NULL);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (self->chunk_queue == NULL) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "Chunks are not queued without max-queued-chunks");
+    return NULL;
+  }
+
+  return mars_chunk_queue_pop (self->chunk_queue, cancellable, error);
+}
+
+
+static void
+next_chunk_thread (GTask        *task,
+                   MarsChunker  *self,
+                   gpointer      task_data,
+                   GCancellable *cancellable)
+{
+  GstBufferList *chunk;
+  GError *error = NULL;
+
+  chunk = mars_chunker_next_chunk (self, cancellable, &error);
+
+  if (error != NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, chunk, (GDestroyNotify) gst_buffer_list_unref);
+}
+
+
+/**
+ * mars_chunker_next_chunk_async:
+ * @self: The chunker
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: Called once the chunk is ready
+ * @user_data: Data for @callback
+ *
+ * Asynchronous version of [method@Mars.Chunker.next_chunk].
+ */
+void
+mars_chunker_next_chunk_async (MarsChunker        *self,
+                               GCancellable       *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer            user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (MARS_IS_CHUNKER (self));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mars_chunker_next_chunk_async);
+  g_task_run_in_thread (task, (GTaskThreadFunc) next_chunk_thread);
+}
+
+
+/**
+ * mars_chunker_next_chunk_finish:
+ * @self: The chunker
+ * @result: The result passed to the callback
+ * @error: Return location for an error
+ *
+ * Finishes [method@Mars.Chunker.next_chunk_async].
+ *
+ * Returns: (transfer full) (nullable): The buffers of the chunk, or %NULL once
+ *   the chunker is stopped and every chunk is pulled, or on error
+ */
+GstBufferList *
+mars_chunker_next_chunk_finish (MarsChunker  *self,
+                                GAsyncResult *result,
+                                GError      **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
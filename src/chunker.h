@@ -6,7 +6,8 @@
 
 #pragma once
 
-#include <glib-object.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
 
 G_BEGIN_DECLS
 
@@ -15,11 +16,50 @@ G_BEGIN_DECLS
 #define MARS_CHUNKER_MINIMUM_SILENCE_TIME GST_SECOND / 2
 #define MARS_CHUNKER_SILENCE_HYSTERESIS 480
 #define MARS_CHUNKER_SILENCE_THRESHOLD -60
+#define MARS_CHUNKER_TARGET_CHUNK_TIME 3 * GST_SECOND
+
+/**
+ * MarsChunkerDetector:
+ * @MARS_CHUNKER_DETECTOR_ENERGY: Silence by level with `removesilence`
+ * @MARS_CHUNKER_DETECTOR_SPECTRAL: Non-speech by sub-band energy and zero
+ *   crossings, which ignores hum and clicks
+ *
+ * How [class@Mars.Chunker] finds the pauses to chunk at.
+ */
+typedef enum {
+  MARS_CHUNKER_DETECTOR_ENERGY,
+  MARS_CHUNKER_DETECTOR_SPECTRAL,
+} MarsChunkerDetector;
+
+#define MARS_TYPE_CHUNKER_DETECTOR mars_chunker_detector_get_type ()
+GType mars_chunker_detector_get_type (void);
+
+/**
+ * MarsChunkerQueues:
+ * @MARS_CHUNKER_QUEUE_NONE: No queues
+ * @MARS_CHUNKER_QUEUE_CAPTURE: Queue after the source, so capturing never
+ *   waits for decoding
+ * @MARS_CHUNKER_QUEUE_DECODE: Queue after decoding
+ * @MARS_CHUNKER_QUEUE_MUX: Queue before muxing, which can move the chunk
+ *   boundaries by up to 100 ms
+ *
+ * Where [class@Mars.Chunker] starts new streaming threads.
+ */
+typedef enum {
+  MARS_CHUNKER_QUEUE_NONE = 0,
+  MARS_CHUNKER_QUEUE_CAPTURE = 1 << 0,
+  MARS_CHUNKER_QUEUE_DECODE = 1 << 1,
+  MARS_CHUNKER_QUEUE_MUX = 1 << 2,
+} MarsChunkerQueues;
+
+#define MARS_TYPE_CHUNKER_QUEUES mars_chunker_queues_get_type ()
+GType mars_chunker_queues_get_type (void);
 
 #define MARS_TYPE_CHUNKER mars_chunker_get_type ()
 G_DECLARE_FINAL_TYPE (MarsChunker, mars_chunker, MARS, CHUNKER, GObject)
 
 MarsChunker *mars_chunker_new (char *input, char *output, char *muxer);
+MarsChunker *mars_chunker_clone (MarsChunker *self, const char *input, const char *output);
 
 gboolean mars_chunker_is_playing (MarsChunker *self);
 
@@ -27,4 +67,17 @@ void     mars_chunker_play (MarsChunker *self);
 void     mars_chunker_pause (MarsChunker *self);
 void     mars_chunker_stop (MarsChunker *self);
 
+GstStructure *mars_chunker_get_stats (MarsChunker *self);
+
+GstBufferList *mars_chunker_next_chunk (MarsChunker  *self,
+                                        GCancellable *cancellable,
+                                        GError      **error);
+void           mars_chunker_next_chunk_async (MarsChunker        *self,
+                                              GCancellable       *cancellable,
+                                              GAsyncReadyCallback callback,
+                                              gpointer            user_data);
+GstBufferList *mars_chunker_next_chunk_finish (MarsChunker  *self,
+                                               GAsyncResult *result,
+                                               GError      **error);
+
 G_END_DECLS
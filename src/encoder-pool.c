@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-encoder-pool"
+
+#include "encoder-pool.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+/*
+ * Encodes raw chunks on a pool of threads, each with its own muxer and
+ * filesink. Chunks are written next to their final location and renamed in
+ * chunk order, so the outputs appear in the same order as with splitmuxsink.
+ */
+
+struct _MarsEncoderPool {
+  char        *muxer;
+  char        *location;
+  GThreadPool *pool;
+
+  GMutex       lock;
+  GCond        cond;
+  GstCaps     *caps;
+  guint        start_index;
+  guint        next_index;
+  guint        next_rename;
+  guint        n_pending;
+  GHashTable  *finished;
+
+  MarsEncoderPoolWrittenFunc written_func;
+  gpointer     written_data;
+};
+
+typedef struct {
+  guint          index;
+  GstCaps       *caps;
+  GstBufferList *buffers;
+} Chunk;
+
+
+static char *
+get_location (MarsEncoderPool *self, guint index)
+{
+  return g_strdup_printf (self->location, index);
+}
+
+
+static gboolean
+encode (MarsEncoderPool *self, Chunk *chunk, const char *location)
+{
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstPad) srcpad = NULL;
+  g_autoptr (GstPad) sinkpad = NULL;
+  g_autoptr (GstBus) bus = NULL;
+  g_autoptr (GstMessage) message = NULL;
+  g_autofree char *stream_id = NULL;
+  GstElement *muxer;
+  GstElement *filesink;
+  GstSegment segment;
+  GstBuffer *first;
+
+  pipeline = gst_pipeline_new (NULL);
+  muxer = gst_element_factory_make (self->muxer, NULL);
+  filesink = gst_element_factory_make_full ("filesink", "location", location, NULL);
+
+  if (muxer == NULL || filesink == NULL) {
+    g_critical ("Unable to create %s and filesink", self->muxer);
+    gst_clear_object (&muxer);
+    gst_clear_object (&filesink);
+    return FALSE;
+  }
+
+  gst_bin_add_many (GST_BIN (pipeline), muxer, filesink, NULL);
+
+  if (!gst_element_link (muxer, filesink)) {
+    g_critical ("Unable to link %s and filesink", self->muxer);
+    return FALSE;
+  }
+
+  srcpad = gst_object_ref_sink (gst_pad_new ("src", GST_PAD_SRC));
+  sinkpad = gst_element_get_compatible_pad (muxer, srcpad, chunk->caps);
+
+  if (sinkpad == NULL || gst_pad_link (srcpad, sinkpad) != GST_PAD_LINK_OK) {
+    g_critical ("Unable to link chunk and %s", self->muxer);
+    return FALSE;
+  }
+
+  gst_pad_set_active (srcpad, TRUE);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  stream_id = g_strdup_printf ("mars-chunk-%u", chunk->index);
+  gst_pad_push_event (srcpad, gst_event_new_stream_start (stream_id));
+  gst_pad_push_event (srcpad, gst_event_new_caps (chunk->caps));
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  first = gst_buffer_list_get (chunk->buffers, 0);
+
+  if (GST_BUFFER_PTS_IS_VALID (first))
+    segment.start = segment.time = GST_BUFFER_PTS (first);
+
+  gst_pad_push_event (srcpad, gst_event_new_segment (&segment));
+
+  for (guint i = 0; i < gst_buffer_list_length (chunk->buffers); i++) {
+    GstBuffer *buffer = gst_buffer_list_get (chunk->buffers, i);
+
+    if (gst_pad_push (srcpad, gst_buffer_ref (buffer)) != GST_FLOW_OK)
+      break;
+  }
+
+  gst_pad_push_event (srcpad, gst_event_new_eos ());
+
+  bus = gst_element_get_bus (pipeline);
+  message = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+                                        GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_pad_set_active (srcpad, FALSE);
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+    g_autoptr (GError) error = NULL;
+
+    gst_message_parse_error (message, &error, NULL);
+    g_critical ("%s: %s", GST_OBJECT_NAME (message->src), error->message);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/*
+ * Renames every encoded chunk that has no pending chunk before it. A failed
+ * chunk has no part, and an empty part marks a chunk with nothing to write.
+ */
+static void
+rename_finished (MarsEncoderPool *self)
+{
+  char *part;
+
+  while (g_hash_table_lookup_extended (self->finished, GUINT_TO_POINTER (self->next_rename),
+                                       NULL, (gpointer *) &part)) {
+    g_autofree char *location = get_location (self, self->next_rename);
+
+    if (part != NULL && *part == '\0' && self->written_func != NULL)
+      self->written_func (self->next_rename, self->written_data);
+    else if (part != NULL && *part != '\0' && g_rename (part, location) != 0)
+      g_warning ("Unable to rename %s: %s", part, g_strerror (errno));
+    else if (part != NULL && self->written_func != NULL)
+      self->written_func (self->next_rename, self->written_data);
+
+    g_hash_table_remove (self->finished, GUINT_TO_POINTER (self->next_rename));
+    self->next_rename++;
+  }
+}
+
+
+static void
+encode_chunk (Chunk *chunk, MarsEncoderPool *self)
+{
+  g_autofree char *location = get_location (self, chunk->index);
+  char *part;
+
+  g_debug ("Encoding chunk: %u", chunk->index);
+  part = g_strconcat (location, ".part", NULL);
+
+  if (!encode (self, chunk, part)) {
+    g_unlink (part);
+    g_clear_pointer (&part, g_free);
+  }
+
+  g_mutex_lock (&self->lock);
+
+  g_hash_table_insert (self->finished, GUINT_TO_POINTER (chunk->index), part);
+  rename_finished (self);
+
+  self->n_pending--;
+  g_cond_broadcast (&self->cond);
+
+  g_mutex_unlock (&self->lock);
+
+  gst_caps_unref (chunk->caps);
+  gst_buffer_list_unref (chunk->buffers);
+  g_free (chunk);
+}
+
+
+MarsEncoderPool *
+mars_encoder_pool_new (const char *muxer, const char *location, guint n_workers)
+{
+  MarsEncoderPool *self = g_new0 (MarsEncoderPool, 1);
+
+  self->muxer = g_strdup (muxer);
+  self->location = g_strdup (location);
+  self->pool = g_thread_pool_new ((GFunc) encode_chunk, self, n_workers, FALSE, NULL);
+  self->finished = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+
+  return self;
+}
+
+
+void
+mars_encoder_pool_free (MarsEncoderPool *self)
+{
+  g_thread_pool_free (self->pool, FALSE, TRUE);
+  g_hash_table_unref (self->finished);
+  gst_clear_caps (&self->caps);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_free (self->muxer);
+  g_free (self->location);
+  g_free (self);
+}
+
+
+/* Numbers the chunks from @index, like `splitmuxsink:start-index`. */
+void
+mars_encoder_pool_set_start_index (MarsEncoderPool *self, guint index)
+{
+  g_mutex_lock (&self->lock);
+  self->start_index = index;
+  self->next_index = index;
+  self->next_rename = index;
+  g_mutex_unlock (&self->lock);
+}
+
+
+/* Calls @func from a worker thread once a chunk is in its final location. */
+void
+mars_encoder_pool_set_written_func (MarsEncoderPool           *self,
+                                    MarsEncoderPoolWrittenFunc func,
+                                    gpointer                   user_data)
+{
+  g_mutex_lock (&self->lock);
+  self->written_func = func;
+  self->written_data = user_data;
+  g_mutex_unlock (&self->lock);
+}
+
+
+void
+mars_encoder_pool_set_caps (MarsEncoderPool *self, GstCaps *caps)
+{
+  g_mutex_lock (&self->lock);
+  gst_caps_replace (&self->caps, caps);
+  g_mutex_unlock (&self->lock);
+}
+
+
+/*
+ * Queues the raw chunk for encoding. Chunks are numbered in the order they are
+ * pushed, and an empty chunk still takes its number so that the numbering
+ * follows splitmuxsink.
+ */
+void
+mars_encoder_pool_push (MarsEncoderPool *self, GstBufferList *buffers)
+{
+  Chunk *chunk;
+
+  g_mutex_lock (&self->lock);
+
+  if (gst_buffer_list_length (buffers) == 0) {
+    g_hash_table_insert (self->finished, GUINT_TO_POINTER (self->next_index++), g_strdup (""));
+    rename_finished (self);
+    g_mutex_unlock (&self->lock);
+    return;
+  }
+
+  if (self->caps == NULL) {
+    g_mutex_unlock (&self->lock);
+    g_warning ("Dropping chunk without caps");
+    return;
+  }
+
+  chunk = g_new0 (Chunk, 1);
+  chunk->index = self->next_index++;
+  chunk->caps = gst_caps_ref (self->caps);
+  chunk->buffers = gst_buffer_list_copy (buffers);
+  self->n_pending++;
+
+  g_mutex_unlock (&self->lock);
+
+  g_thread_pool_push (self->pool, chunk, NULL);
+}
+
+
+/* Waits for the queued chunks and restarts the numbering like splitmuxsink. */
+void
+mars_encoder_pool_finish (MarsEncoderPool *self)
+{
+  g_mutex_lock (&self->lock);
+
+  while (self->n_pending > 0)
+    g_cond_wait (&self->cond, &self->lock);
+
+  self->next_index = self->start_index;
+  self->next_rename = self->start_index;
+
+  g_mutex_unlock (&self->lock);
+}
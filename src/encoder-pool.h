@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MarsEncoderPool MarsEncoderPool;
+
+typedef void (*MarsEncoderPoolWrittenFunc) (guint index, gpointer user_data);
+
+MarsEncoderPool *mars_encoder_pool_new (const char *muxer, const char *location, guint n_workers);
+void             mars_encoder_pool_free (MarsEncoderPool *self);
+
+void             mars_encoder_pool_set_start_index (MarsEncoderPool *self, guint index);
+void             mars_encoder_pool_set_written_func (MarsEncoderPool           *self,
+                                                     MarsEncoderPoolWrittenFunc func,
+                                                     gpointer                   user_data);
+void             mars_encoder_pool_set_caps (MarsEncoderPool *self, GstCaps *caps);
+void             mars_encoder_pool_push (MarsEncoderPool *self, GstBufferList *buffers);
+void             mars_encoder_pool_finish (MarsEncoderPool *self);
+
+G_END_DECLS
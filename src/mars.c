@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars"
+
+#include "mars.h"
+#include "callback-sink.h"
+#include "chunker.h"
+#include "resample.h"
+
+/*
+ * The first chunker of a process loads the plugins of every element it uses,
+ * runs their class initialization and loads the typefinders of decodebin.
+ * Doing that ahead of time keeps it out of the first chunk.
+ */
+
+static const char * const ELEMENTS[] = {
+  "filesrc",
+  "autoaudiosrc",
+  "decodebin",
+  "typefind",
+  "queue",
+  "audioconvert",
+  "removesilence",
+  "marsresample",
+  "audioresample",
+  "capsfilter",
+  "deinterleave",
+  "splitmuxsink",
+  "identity",
+  "filesink",
+  "wavparse",
+  "wavenc",
+  NULL,
+};
+
+/* Loaded factories are kept so their plugins are never looked up again. */
+G_LOCK_DEFINE_STATIC (factories);
+static GPtrArray *factories = NULL;
+
+
+static gboolean
+prewarm_element (const char *name)
+{
+  g_autoptr (GstElementFactory) factory = NULL;
+  GstPluginFeature *loaded;
+  GstElement *element;
+
+  factory = gst_element_factory_find (name);
+
+  if (factory == NULL) {
+    g_debug ("No element to prewarm: %s", name);
+    return FALSE;
+  }
+
+  loaded = gst_plugin_feature_load (GST_PLUGIN_FEATURE (factory));
+
+  if (loaded == NULL) {
+    g_warning ("Unable to load element: %s", name);
+    return FALSE;
+  }
+
+  g_ptr_array_add (factories, loaded);
+
+  /* Creating it once runs the class initialization. */
+  element = gst_element_factory_create (GST_ELEMENT_FACTORY (loaded), NULL);
+
+  if (element != NULL)
+    gst_object_unref (gst_object_ref_sink (element));
+
+  return TRUE;
+}
+
+
+static void
+prewarm_typefinders (void)
+{
+  GList *typefinders = gst_type_find_factory_get_list ();
+
+  for (GList *l = typefinders; l != NULL; l = l->next) {
+    GstPluginFeature *loaded = gst_plugin_feature_load (l->data);
+
+    if (loaded != NULL)
+      g_ptr_array_add (factories, loaded);
+  }
+
+  gst_plugin_feature_list_free (typefinders);
+}
+
+
+/**
+ * mars_init:
+ * @argc: (inout) (nullable): Pointer to the number of arguments
+ * @argv: (inout) (array length=argc) (nullable): Pointer to the arguments
+ *
+ * Initializes GStreamer and the types of Mars, and prewarms the elements
+ * [class@Mars.Chunker] uses with [func@Mars.prewarm].
+ */
+void
+mars_init (int *argc, char ***argv)
+{
+  gst_init (argc, argv);
+
+  g_type_ensure (MARS_TYPE_CALLBACK_SINK);
+  g_type_ensure (MARS_TYPE_CHUNKER);
+
+  mars_prewarm (NULL);
+}
+
+
+/**
+ * mars_prewarm:
+ * @elements: (array zero-terminated=1) (nullable): More elements to load,
+ *   like the muxers and decoders in use
+ *
+ * Loads the plugins of the elements [class@Mars.Chunker] uses, the
+ * typefinders and @elements, and initializes their classes, so that the
+ * first chunker does not wait for it. Can be called again with more
+ * elements and from any thread.
+ *
+ * Returns: Whether all of @elements were loaded
+ */
+gboolean
+mars_prewarm (const char * const *elements)
+{
+  gboolean loaded = TRUE;
+  gint64 begin = g_get_monotonic_time ();
+
+  G_LOCK (factories);
+
+  if (factories == NULL) {
+    mars_resample_register ();
+    factories = g_ptr_array_new_with_free_func (gst_object_unref);
+
+    for (guint i = 0; ELEMENTS[i] != NULL; i++)
+      prewarm_element (ELEMENTS[i]);
+
+    prewarm_typefinders ();
+  }
+
+  for (guint i = 0; elements != NULL && elements[i] != NULL; i++)
+    loaded &= prewarm_element (elements[i]);
+
+  G_UNLOCK (factories);
+
+  g_debug ("Prewarmed in %" G_GINT64_FORMAT " us", g_get_monotonic_time () - begin);
+
+  return loaded;
+}
@@ -0,0 +1,16 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+void     mars_init (int *argc, char ***argv);
+gboolean mars_prewarm (const char * const *elements);
+
+G_END_DECLS
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-polyphase"
+
+#include "polyphase.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Downsamples by a fixed ratio L/M with a polyphase FIR filter.
+ *
+ * The prototype is a Kaiser windowed sinc at the output Nyquist frequency on
+ * the grid upsampled by L. It is split into L phases of K taps, stored
+ * reversed and padded to a multiple of 8, so every output sample is a single
+ * dot product over contiguous input samples. The quality sets the number of
+ * zero crossings of the sinc and the window, like `audioresample:quality`.
+ */
+
+#define TAP_ALIGN 8
+#define MAX_PHASES 512
+
+struct _MarsPolyphase {
+  guint    l;
+  guint    m;
+  guint    n_taps;
+  gint     channels;
+  gfloat  *coeffs;
+
+  /* Planar history, the oldest sample still needed first. */
+  gfloat  *history;
+  gsize    capacity;
+  gsize    length;
+
+  /* Position of the next output on the upsampled grid. */
+  guint64  position;
+};
+
+
+gboolean
+mars_polyphase_supports (gint in_rate, gint out_rate)
+{
+  return (in_rate == 44100 || in_rate == 48000) &&
+         (out_rate == 8000 || out_rate == 16000);
+}
+
+
+static gdouble
+bessel_i0 (gdouble x)
+{
+  gdouble sum = 1;
+  gdouble term = 1;
+
+  for (gint k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+
+    if (term < sum * 1e-12)
+      break;
+  }
+
+  return sum;
+}
+
+
+static void
+design (MarsPolyphase *self, gint quality)
+{
+  guint n_zeros = 4 + 2 * quality;
+  gdouble beta = 5 + 0.5 * quality;
+  gdouble rolloff = 0.85 + 0.01 * quality;
+  gdouble cutoff;
+  gdouble center;
+  guint n;
+
+  /* Enough input samples to hold the zero crossings at the output rate. */
+  self->n_taps = (guint) ceil (2.0 * n_zeros * self->m / self->l);
+  self->n_taps = (self->n_taps + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+
+  /* An odd length keeps the center on the grid, the last tap stays zero. */
+  n = self->l * self->n_taps - 1;
+  cutoff = rolloff / (2.0 * self->m);
+  center = (n - 1) / 2;
+
+  self->coeffs = g_new0 (gfloat, self->l * self->n_taps);
+
+  for (guint i = 0; i < n; i++) {
+    gdouble t = i - center;
+    gdouble r = t / (center + 1);
+    gdouble sinc = t == 0 ? 1 : sin (2 * G_PI * cutoff * t) / (2 * G_PI * cutoff * t);
+    gdouble window = bessel_i0 (beta * sqrt (MAX (0, 1 - r * r))) / bessel_i0 (beta);
+    gdouble h = 2 * cutoff * self->l * sinc * window;
+    guint phase = i % self->l;
+    guint tap = i / self->l;
+
+    self->coeffs[phase * self->n_taps + (self->n_taps - 1 - tap)] = h;
+  }
+}
+
+
+MarsPolyphase *
+mars_polyphase_new (gint in_rate, gint out_rate, gint channels, gint quality)
+{
+  MarsPolyphase *self;
+  guint gcd = in_rate;
+  guint b = out_rate;
+
+  while (b != 0) {
+    guint t = gcd % b;
+
+    gcd = b;
+    b = t;
+  }
+
+  if (out_rate >= in_rate || out_rate / gcd > MAX_PHASES) {
+    g_critical ("Unable to resample from %d to %d", in_rate, out_rate);
+    return NULL;
+  }
+
+  self = g_new0 (MarsPolyphase, 1);
+  self->l = out_rate / gcd;
+  self->m = in_rate / gcd;
+  self->channels = channels;
+
+  design (self, CLAMP (quality, 0, 10));
+  mars_polyphase_reset (self);
+
+  g_debug ("Resampling by %u/%u with %u taps", self->l, self->m, self->n_taps);
+
+  return self;
+}
+
+
+void
+mars_polyphase_free (MarsPolyphase *self)
+{
+  g_free (self->coeffs);
+  g_free (self->history);
+  g_free (self);
+}
+
+
+/*
+ * Starts over with silence before the first sample. The first output is
+ * centered on the first input, so the filter adds no delay.
+ */
+void
+mars_polyphase_reset (MarsPolyphase *self)
+{
+  guint64 center = (self->l * self->n_taps - 2) / 2;
+
+  self->length = self->n_taps - 1;
+
+  if (self->capacity < self->length) {
+    self->capacity = self->length;
+    self->history = g_renew (gfloat, self->history, self->capacity * self->channels);
+  }
+
+  memset (self->history, 0, sizeof (gfloat) * self->capacity * self->channels);
+
+  self->position = (guint64) (self->n_taps - 1) * self->l + center;
+}
+
+
+/* Input frames the filter has to look ahead before an output is complete. */
+gsize
+mars_polyphase_get_delay (MarsPolyphase *self)
+{
+  return (self->l * self->n_taps - 2) / 2 / self->l + 1;
+}
+
+
+gsize
+mars_polyphase_get_max_output (MarsPolyphase *self, gsize n_frames)
+{
+  guint64 end = (guint64) (self->length + n_frames) * self->l;
+
+  if (end <= self->position)
+    return 0;
+
+  return (end - self->position + self->m - 1) / self->m;
+}
+
+
+static inline gfloat
+dot (const gfloat *x, const gfloat *h, guint n)
+{
+#if defined (__SSE__)
+  __m128 sum0 = _mm_setzero_ps ();
+  __m128 sum1 = _mm_setzero_ps ();
+  gfloat sums[4];
+
+  for (guint i = 0; i < n; i += 8) {
+    sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_loadu_ps (x + i), _mm_loadu_ps (h + i)));
+    sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_loadu_ps (x + i + 4), _mm_loadu_ps (h + i + 4)));
+  }
+
+  _mm_storeu_ps (sums, _mm_add_ps (sum0, sum1));
+
+  return sums[0] + sums[1] + sums[2] + sums[3];
+#elif defined (__ARM_NEON)
+  float32x4_t sum0 = vdupq_n_f32 (0);
+  float32x4_t sum1 = vdupq_n_f32 (0);
+  float32x4_t sum;
+
+  for (guint i = 0; i < n; i += 8) {
+    sum0 = vmlaq_f32 (sum0, vld1q_f32 (x + i), vld1q_f32 (h + i));
+    sum1 = vmlaq_f32 (sum1, vld1q_f32 (x + i + 4), vld1q_f32 (h + i + 4));
+  }
+
+  sum = vaddq_f32 (sum0, sum1);
+
+  return vgetq_lane_f32 (sum, 0) + vgetq_lane_f32 (sum, 1) +
+         vgetq_lane_f32 (sum, 2) + vgetq_lane_f32 (sum, 3);
+#else
+  gfloat sum[TAP_ALIGN] = { 0 };
+
+  for (guint i = 0; i < n; i += TAP_ALIGN)
+    for (guint j = 0; j < TAP_ALIGN; j++)
+      sum[j] += x[i + j] * h[i + j];
+
+  return sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+#endif
+}
+
+
+static void
+append (MarsPolyphase *self, const gint16 *in, gsize n_frames)
+{
+  gsize length = self->length + n_frames;
+  gint channels = self->channels;
+
+  if (length > self->capacity) {
+    gsize capacity = MAX (length, self->capacity * 2);
+    gfloat *history = g_new (gfloat, capacity * channels);
+
+    for (gint c = 0; c < channels; c++)
+      memcpy (history + c * capacity, self->history + c * self->capacity,
+              sizeof (gfloat) * self->length);
+
+    g_free (self->history);
+    self->history = history;
+    self->capacity = capacity;
+  }
+
+  for (gint c = 0; c < channels; c++) {
+    gfloat *x = self->history + c * self->capacity + self->length;
+
+    for (gsize i = 0; i < n_frames; i++)
+      x[i] = in[i * channels + c] * (1.0f / 32768);
+  }
+
+  self->length = length;
+}
+
+
+/* Forgets the samples that no later output reaches back to. */
+static void
+discard (MarsPolyphase *self)
+{
+  gsize first = self->position / self->l - (self->n_taps - 1);
+
+  if (first == 0)
+    return;
+
+  for (gint c = 0; c < self->channels; c++) {
+    gfloat *x = self->history + c * self->capacity;
+
+    memmove (x, x + first, sizeof (gfloat) * (self->length - first));
+  }
+
+  self->length -= first;
+  self->position -= (guint64) first * self->l;
+}
+
+
+/*
+ * Resamples @n_frames interleaved frames into @out, which must hold
+ * mars_polyphase_get_max_output() frames, and returns the frames written.
+ */
+gsize
+mars_polyphase_process (MarsPolyphase *self,
+                        const gint16  *in,
+                        gsize          n_frames,
+                        gint16        *out)
+{
+  gint channels = self->channels;
+  gsize n_out = 0;
+
+  append (self, in, n_frames);
+
+  while (self->position / self->l < self->length) {
+    gsize base = self->position / self->l;
+    const gfloat *h = self->coeffs + (self->position % self->l) * self->n_taps;
+
+    for (gint c = 0; c < channels; c++) {
+      const gfloat *x = self->history + c * self->capacity + base - (self->n_taps - 1);
+      gfloat y = dot (x, h, self->n_taps) * 32768;
+
+      out[n_out * channels + c] = (gint16) CLAMP (lrintf (y), G_MININT16, G_MAXINT16);
+    }
+
+    self->position += self->m;
+    n_out++;
+  }
+
+  discard (self);
+
+  return n_out;
+}
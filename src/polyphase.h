@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MarsPolyphase MarsPolyphase;
+
+gboolean       mars_polyphase_supports (gint in_rate, gint out_rate);
+
+MarsPolyphase *mars_polyphase_new (gint in_rate, gint out_rate, gint channels, gint quality);
+void           mars_polyphase_free (MarsPolyphase *self);
+
+gsize          mars_polyphase_get_max_output (MarsPolyphase *self, gsize n_frames);
+gsize          mars_polyphase_get_delay (MarsPolyphase *self);
+gsize          mars_polyphase_process (MarsPolyphase *self,
+                                       const gint16  *in,
+                                       gsize          n_frames,
+                                       gint16        *out);
+void           mars_polyphase_reset (MarsPolyphase *self);
+
+G_END_DECLS
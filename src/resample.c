@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-resample"
+
+#include "resample.h"
+#include "polyphase.h"
+
+/*
+ * Converts 44.1 and 48 kHz to the 8 or 16 kHz of `rate` with the polyphase
+ * filters and passes every other rate through, so that an `audioresample`
+ * after it only has work to do for the uncommon rates.
+ */
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define FORMAT "S16LE"
+#else
+#define FORMAT "S16BE"
+#endif
+
+enum {
+  PROP_0,
+  PROP_RATE,
+  PROP_QUALITY,
+  PROP_LAST_PROP,
+};
+
+static GParamSpec *props[PROP_LAST_PROP];
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+                                                                    GST_PAD_SINK,
+                                                                    GST_PAD_ALWAYS,
+                                                                    GST_STATIC_CAPS ("audio/x-raw, "
+                                                                                     "format = (string) " FORMAT ", "
+                                                                                     "layout = (string) interleaved, "
+                                                                                     "rate = (int) [ 1, MAX ], "
+                                                                                     "channels = (int) [ 1, MAX ]"));
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+                                                                   GST_PAD_SRC,
+                                                                   GST_PAD_ALWAYS,
+                                                                   GST_STATIC_CAPS ("audio/x-raw, "
+                                                                                    "format = (string) " FORMAT ", "
+                                                                                    "layout = (string) interleaved, "
+                                                                                    "rate = (int) [ 1, MAX ], "
+                                                                                    "channels = (int) [ 1, MAX ]"));
+
+struct _MarsResample {
+  GstBaseTransform parent;
+
+  gint           rate;
+  gint           quality;
+
+  gint           in_rate;
+  gint           out_rate;
+  gint           channels;
+  MarsPolyphase *polyphase;
+
+  /* Timestamps are counted from the first buffer after a reset. */
+  GstClockTime   start;
+  guint64        in_frames;
+  guint64        out_frames;
+};
+
+G_DEFINE_TYPE (MarsResample, mars_resample, GST_TYPE_BASE_TRANSFORM)
+
+
+static void
+mars_resample_set_property (GObject      *object,
+                            guint         property_id,
+                            const GValue *value,
+                            GParamSpec   *pspec)
+{
+  MarsResample *self = MARS_RESAMPLE (object);
+
+  switch (property_id) {
+  case PROP_RATE:
+    self->rate = g_value_get_int (value);
+    break;
+  case PROP_QUALITY:
+    self->quality = g_value_get_int (value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+
+static void
+mars_resample_get_property (GObject    *object,
+                            guint       property_id,
+                            GValue     *value,
+                            GParamSpec *pspec)
+{
+  MarsResample *self = MARS_RESAMPLE (object);
+
+  switch (property_id) {
+  case PROP_RATE:
+    g_value_set_int (value, self->rate);
+    break;
+  case PROP_QUALITY:
+    g_value_set_int (value, self->quality);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+
+static void
+reset (MarsResample *self)
+{
+  if (self->polyphase != NULL)
+    mars_polyphase_reset (self->polyphase);
+
+  self->start = GST_CLOCK_TIME_NONE;
+  self->in_frames = 0;
+  self->out_frames = 0;
+}
+
+
+/* Offers `rate` first wherever the filters cover the conversion. */
+static GstCaps *
+mars_resample_transform_caps (GstBaseTransform *trans,
+                              GstPadDirection   direction,
+                              GstCaps          *caps,
+                              GstCaps          *filter)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+  static const gint in_rates[] = { 48000, 44100 };
+  GstCaps *result = gst_caps_new_empty ();
+  guint n = gst_caps_get_size (caps);
+
+  for (guint i = 0; i < n; i++) {
+    GstStructure *structure = gst_caps_get_structure (caps, i);
+    gint rate;
+
+    if (!gst_structure_get_int (structure, "rate", &rate)) {
+      GstStructure *copy = gst_structure_copy (structure);
+
+      gst_structure_remove_field (copy, "rate");
+      result = gst_caps_merge_structure (result, copy);
+      continue;
+    }
+
+    if (direction == GST_PAD_SINK && mars_polyphase_supports (rate, self->rate)) {
+      GstStructure *copy = gst_structure_copy (structure);
+
+      gst_structure_set (copy, "rate", G_TYPE_INT, self->rate, NULL);
+      result = gst_caps_merge_structure (result, copy);
+    } else if (direction == GST_PAD_SRC && rate == self->rate) {
+      for (guint j = 0; j < G_N_ELEMENTS (in_rates); j++) {
+        GstStructure *copy;
+
+        if (!mars_polyphase_supports (in_rates[j], rate))
+          continue;
+
+        copy = gst_structure_copy (structure);
+        gst_structure_set (copy, "rate", G_TYPE_INT, in_rates[j], NULL);
+        result = gst_caps_merge_structure (result, copy);
+      }
+    }
+
+    result = gst_caps_merge_structure (result, gst_structure_copy (structure));
+  }
+
+  if (filter != NULL) {
+    GstCaps *intersection = gst_caps_intersect_full (filter, result, GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref (result);
+    result = intersection;
+  }
+
+  return result;
+}
+
+
+static GstCaps *
+mars_resample_fixate_caps (GstBaseTransform *trans,
+                           GstPadDirection   direction,
+                           GstCaps          *caps,
+                           GstCaps          *othercaps)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+  GstStructure *structure = gst_caps_get_structure (caps, 0);
+  gint rate;
+  guint n;
+
+  if (direction != GST_PAD_SINK ||
+      !gst_structure_get_int (structure, "rate", &rate) ||
+      !mars_polyphase_supports (rate, self->rate))
+    return GST_BASE_TRANSFORM_CLASS (mars_resample_parent_class)->fixate_caps (trans, direction,
+                                                                              caps, othercaps);
+
+  othercaps = gst_caps_make_writable (othercaps);
+  n = gst_caps_get_size (othercaps);
+
+  for (guint i = 0; i < n; i++) {
+    GstStructure *other = gst_caps_get_structure (othercaps, i);
+    gint other_rate;
+
+    if (gst_structure_fixate_field_nearest_int (other, "rate", self->rate) &&
+        gst_structure_get_int (other, "rate", &other_rate) &&
+        other_rate == self->rate) {
+      GstCaps *result = gst_caps_copy_nth (othercaps, i);
+
+      gst_caps_unref (othercaps);
+      return gst_caps_fixate (result);
+    }
+  }
+
+  return gst_caps_fixate (othercaps);
+}
+
+
+static gboolean
+mars_resample_set_caps (GstBaseTransform *trans, GstCaps *incaps, GstCaps *outcaps)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+  GstStructure *in = gst_caps_get_structure (incaps, 0);
+  GstStructure *out = gst_caps_get_structure (outcaps, 0);
+
+  if (!gst_structure_get_int (in, "rate", &self->in_rate) ||
+      !gst_structure_get_int (out, "rate", &self->out_rate) ||
+      !gst_structure_get_int (in, "channels", &self->channels))
+    return FALSE;
+
+  g_clear_pointer (&self->polyphase, mars_polyphase_free);
+
+  if (self->in_rate == self->out_rate) {
+    gst_base_transform_set_passthrough (trans, TRUE);
+    return TRUE;
+  }
+
+  if (!mars_polyphase_supports (self->in_rate, self->out_rate))
+    return FALSE;
+
+  self->polyphase = mars_polyphase_new (self->in_rate, self->out_rate,
+                                        self->channels, self->quality);
+  gst_base_transform_set_passthrough (trans, FALSE);
+  reset (self);
+
+  return self->polyphase != NULL;
+}
+
+
+static gboolean
+mars_resample_transform_size (GstBaseTransform *trans,
+                              GstPadDirection   direction,
+                              GstCaps          *caps,
+                              gsize             size,
+                              GstCaps          *othercaps,
+                              gsize            *othersize)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+  gsize frame_size = sizeof (gint16) * self->channels;
+
+  if (self->polyphase == NULL)
+    return FALSE;
+
+  if (direction == GST_PAD_SINK)
+    *othersize = mars_polyphase_get_max_output (self->polyphase, size / frame_size) * frame_size;
+  else
+    *othersize = gst_util_uint64_scale_int_ceil (size / frame_size, self->in_rate,
+                                                 self->out_rate) * frame_size;
+
+  return TRUE;
+}
+
+
+static void
+set_timestamps (MarsResample *self, GstBuffer *buffer, gsize n_frames)
+{
+  GstClockTime begin = gst_util_uint64_scale_int (self->out_frames, GST_SECOND, self->out_rate);
+  GstClockTime end = gst_util_uint64_scale_int (self->out_frames + n_frames,
+                                                GST_SECOND, self->out_rate);
+
+  if (GST_CLOCK_TIME_IS_VALID (self->start)) {
+    GST_BUFFER_PTS (buffer) = self->start + begin;
+    GST_BUFFER_DURATION (buffer) = end - begin;
+  }
+
+  GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_OFFSET (buffer) = self->out_frames;
+  GST_BUFFER_OFFSET_END (buffer) = self->out_frames + n_frames;
+  self->out_frames += n_frames;
+}
+
+
+static GstFlowReturn
+mars_resample_transform (GstBaseTransform *trans, GstBuffer *inbuf, GstBuffer *outbuf)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+  gsize frame_size = sizeof (gint16) * self->channels;
+  GstMapInfo in;
+  GstMapInfo out;
+  gsize n_frames;
+
+  if (GST_BUFFER_IS_DISCONT (inbuf) && self->in_frames != 0)
+    reset (self);
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->start))
+    self->start = GST_BUFFER_PTS (inbuf);
+
+  if (!gst_buffer_map (inbuf, &in, GST_MAP_READ))
+    return GST_FLOW_ERROR;
+
+  if (!gst_buffer_map (outbuf, &out, GST_MAP_WRITE)) {
+    gst_buffer_unmap (inbuf, &in);
+    return GST_FLOW_ERROR;
+  }
+
+  n_frames = mars_polyphase_process (self->polyphase, (const gint16 *) in.data,
+                                     in.size / frame_size, (gint16 *) out.data);
+  self->in_frames += in.size / frame_size;
+
+  gst_buffer_unmap (outbuf, &out);
+  gst_buffer_unmap (inbuf, &in);
+
+  if (n_frames == 0)
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+
+  gst_buffer_set_size (outbuf, n_frames * frame_size);
+  set_timestamps (self, outbuf, n_frames);
+
+  return GST_FLOW_OK;
+}
+
+
+/* Pushes the outputs still waiting for the filter to look ahead. */
+static void
+drain (MarsResample *self)
+{
+  gsize frame_size = sizeof (gint16) * self->channels;
+  g_autofree gint16 *silence = NULL;
+  g_autofree gint16 *samples = NULL;
+  guint64 expected;
+  gsize delay;
+  gsize n_frames;
+  GstBuffer *buffer;
+
+  if (self->polyphase == NULL || self->in_frames == 0)
+    return;
+
+  expected = gst_util_uint64_scale_int_ceil (self->in_frames, self->out_rate, self->in_rate);
+
+  if (expected <= self->out_frames)
+    return;
+
+  delay = mars_polyphase_get_delay (self->polyphase);
+  silence = g_new0 (gint16, delay * self->channels);
+  samples = g_new (gint16, mars_polyphase_get_max_output (self->polyphase, delay) * self->channels);
+
+  n_frames = mars_polyphase_process (self->polyphase, silence, delay, samples);
+  n_frames = MIN (n_frames, expected - self->out_frames);
+
+  if (n_frames == 0)
+    return;
+
+  buffer = gst_buffer_new_memdup (samples, n_frames * frame_size);
+  set_timestamps (self, buffer, n_frames);
+  gst_pad_push (GST_BASE_TRANSFORM_SRC_PAD (self), buffer);
+}
+
+
+static gboolean
+mars_resample_sink_event (GstBaseTransform *trans, GstEvent *event)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+
+  switch (GST_EVENT_TYPE (event)) {
+  case GST_EVENT_EOS:
+    drain (self);
+    reset (self);
+    break;
+  case GST_EVENT_FLUSH_STOP:
+  case GST_EVENT_STREAM_START:
+    reset (self);
+    break;
+  default:
+    break;
+  }
+
+  return GST_BASE_TRANSFORM_CLASS (mars_resample_parent_class)->sink_event (trans, event);
+}
+
+
+static gboolean
+mars_resample_stop (GstBaseTransform *trans)
+{
+  MarsResample *self = MARS_RESAMPLE (trans);
+
+  g_clear_pointer (&self->polyphase, mars_polyphase_free);
+
+  return TRUE;
+}
+
+
+static void
+mars_resample_finalize (GObject *object)
+{
+  MarsResample *self = MARS_RESAMPLE (object);
+
+  g_clear_pointer (&self->polyphase, mars_polyphase_free);
+
+  G_OBJECT_CLASS (mars_resample_parent_class)->finalize (object);
+}
+
+
+static void
+mars_resample_class_init (MarsResampleClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *transform_class = GST_BASE_TRANSFORM_CLASS (klass);
+
+  object_class->set_property = mars_resample_set_property;
+  object_class->get_property = mars_resample_get_property;
+  object_class->finalize = mars_resample_finalize;
+
+  transform_class->transform_caps = mars_resample_transform_caps;
+  transform_class->fixate_caps = mars_resample_fixate_caps;
+  transform_class->set_caps = mars_resample_set_caps;
+  transform_class->transform_size = mars_resample_transform_size;
+  transform_class->transform = mars_resample_transform;
+  transform_class->sink_event = mars_resample_sink_event;
+  transform_class->stop = mars_resample_stop;
+
+  /**
+   * MarsResample:rate:
+   *
+   * The rate to convert 44.1 and 48 kHz to.
+   */
+  props[PROP_RATE] =
+    g_param_spec_int ("rate", "", "",
+                      1, G_MAXINT, 16000,
+                      G_PARAM_READWRITE |
+                      G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MarsResample:quality:
+   *
+   * Filter quality, from `0` for the fastest to `10` for the best, like
+   * `audioresample:quality`.
+   */
+  props[PROP_QUALITY] =
+    g_param_spec_int ("quality", "", "",
+                      0, 10, 4,
+                      G_PARAM_READWRITE |
+                      G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, PROP_LAST_PROP, props);
+
+  gst_element_class_add_static_pad_template (element_class, &sinktemplate);
+  gst_element_class_add_static_pad_template (element_class, &srctemplate);
+  gst_element_class_set_static_metadata (element_class,
+                                         "Resample",
+                                         "Filter/Converter/Audio",
+                                         "Downsamples 44.1 and 48 kHz for speech",
+                                         "Arun Mani J <arunmani@peartree.to>");
+}
+
+
+static void
+mars_resample_init (MarsResample *self)
+{
+  self->rate = 16000;
+  self->quality = 4;
+  self->start = GST_CLOCK_TIME_NONE;
+}
+
+
+/* Makes the element available as `marsresample` to pipeline descriptions. */
+gboolean
+mars_resample_register (void)
+{
+  return gst_element_register (NULL, "marsresample", GST_RANK_NONE, MARS_TYPE_RESAMPLE);
+}
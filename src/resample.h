@@ -0,0 +1,18 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gst/base/base.h>
+
+G_BEGIN_DECLS
+
+#define MARS_TYPE_RESAMPLE mars_resample_get_type ()
+G_DECLARE_FINAL_TYPE (MarsResample, mars_resample, MARS, RESAMPLE, GstBaseTransform)
+
+gboolean mars_resample_register (void);
+
+G_END_DECLS
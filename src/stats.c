@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "stats.h"
+
+
+void
+mars_counter_add (MarsCounter *counter, guint64 value)
+{
+  atomic_fetch_add_explicit (counter, value, memory_order_relaxed);
+}
+
+
+void
+mars_counter_set (MarsCounter *counter, guint64 value)
+{
+  atomic_store_explicit (counter, value, memory_order_relaxed);
+}
+
+
+void
+mars_counter_max (MarsCounter *counter, guint64 value)
+{
+  guint64 current = mars_counter_get (counter);
+
+  while (current < value &&
+         !atomic_compare_exchange_weak_explicit (counter, &current, value,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed)) {
+  }
+}
+
+
+guint64
+mars_counter_get (MarsCounter *counter)
+{
+  return atomic_load_explicit (counter, memory_order_relaxed);
+}
+
+
+guint64
+mars_counter_exchange (MarsCounter *counter, guint64 value)
+{
+  return atomic_exchange_explicit (counter, value, memory_order_relaxed);
+}
+
+
+/*
+ * Values land in power-of-two buckets of microseconds, so recording is a single
+ * increment and percentiles are accurate up to a factor of two.
+ */
+void
+mars_histogram_record (MarsHistogram *self, guint64 value)
+{
+  guint bucket;
+
+  bucket = g_bit_storage (value / 1000) - 1;
+  bucket = MIN (bucket, MARS_HISTOGRAM_N_BUCKETS - 1);
+
+  mars_counter_add (&self->buckets[bucket], 1);
+  mars_counter_add (&self->count, 1);
+}
+
+
+guint64
+mars_histogram_percentile (MarsHistogram *self, gdouble percentile)
+{
+  guint64 count;
+  guint64 rank;
+  guint64 seen = 0;
+
+  count = mars_counter_get (&self->count);
+
+  if (count == 0)
+    return 0;
+
+  rank = MAX (1, (guint64) (count * percentile / 100));
+
+  for (guint i = 0; i < MARS_HISTOGRAM_N_BUCKETS; i++) {
+    seen += mars_counter_get (&self->buckets[i]);
+
+    if (seen >= rank)
+      return (G_GUINT64_CONSTANT (1) << (i + 1)) * 1000;
+  }
+
+  return (G_GUINT64_CONSTANT (1) << MARS_HISTOGRAM_N_BUCKETS) * 1000;
+}
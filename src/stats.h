@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include <stdatomic.h>
+
+G_BEGIN_DECLS
+
+#define MARS_HISTOGRAM_N_BUCKETS 40
+
+/*
+ * Counters are updated from streaming threads and read from any thread, so
+ * they never take a lock.
+ */
+typedef _Atomic guint64 MarsCounter;
+
+typedef struct {
+  MarsCounter buckets[MARS_HISTOGRAM_N_BUCKETS];
+  MarsCounter count;
+} MarsHistogram;
+
+void    mars_counter_add (MarsCounter *counter, guint64 value);
+void    mars_counter_set (MarsCounter *counter, guint64 value);
+void    mars_counter_max (MarsCounter *counter, guint64 value);
+guint64 mars_counter_get (MarsCounter *counter);
+guint64 mars_counter_exchange (MarsCounter *counter, guint64 value);
+
+void    mars_histogram_record (MarsHistogram *self, guint64 value);
+guint64 mars_histogram_percentile (MarsHistogram *self, gdouble percentile);
+
+G_END_DECLS
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+#define G_LOG_DOMAIN "mars-threads"
+
+#include "threads.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+
+#ifdef __linux__
+/* Parses CPU lists like `0-3,6`. */
+static gboolean
+parse_cpus (const char *cpus, cpu_set_t *set)
+{
+  g_auto (GStrv) ranges = g_strsplit (cpus, ",", -1);
+
+  CPU_ZERO (set);
+
+  for (guint i = 0; ranges[i] != NULL; i++) {
+    guint64 first;
+    guint64 last;
+    char *end;
+
+    first = g_ascii_strtoull (ranges[i], &end, 10);
+
+    if (end == ranges[i])
+      return FALSE;
+
+    last = first;
+
+    if (*end == '-')
+      last = g_ascii_strtoull (end + 1, &end, 10);
+
+    if (*end != '\0' || last < first || last >= CPU_SETSIZE)
+      return FALSE;
+
+    for (guint64 cpu = first; cpu <= last; cpu++)
+      CPU_SET (cpu, set);
+  }
+
+  return TRUE;
+}
+#endif
+
+
+/*
+ * Configures the calling thread. Names are cut to the 15 characters allowed by
+ * Linux, `NULL` CPUs keep the affinity and a priority of `0` keeps the
+ * scheduling policy. Returns whether everything could be applied.
+ */
+gboolean
+mars_thread_configure (const char *name, const char *cpus, gint priority)
+{
+  gboolean configured = TRUE;
+
+#ifdef __linux__
+  if (name != NULL) {
+    char thread_name[16];
+
+    g_strlcpy (thread_name, name, sizeof (thread_name));
+    pthread_setname_np (pthread_self (), thread_name);
+  }
+
+  if (cpus != NULL) {
+    cpu_set_t set;
+
+    if (!parse_cpus (cpus, &set)) {
+      g_warning ("Invalid CPUs: %s", cpus);
+      configured = FALSE;
+    } else if (pthread_setaffinity_np (pthread_self (), sizeof (set), &set) != 0) {
+      g_warning ("Unable to set affinity to CPUs %s", cpus);
+      configured = FALSE;
+    }
+  }
+
+  if (priority > 0) {
+    struct sched_param param = { .sched_priority = priority };
+    int error = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+
+    if (error != 0) {
+      g_warning ("Unable to set real-time priority %d: %s", priority, g_strerror (error));
+      configured = FALSE;
+    }
+  }
+#else
+  if (cpus != NULL || priority > 0) {
+    g_warning ("Thread affinity and priority are only supported on Linux");
+    configured = FALSE;
+  }
+#endif
+
+  return configured;
+}
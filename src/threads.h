@@ -0,0 +1,15 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean mars_thread_configure (const char *name, const char *cpus, gint priority);
+
+G_END_DECLS
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "mars-vad"
+
+#include "vad.h"
+
+#include <math.h>
+
+/*
+ * Classifies 10 ms frames as speech or noise from their level, the share of
+ * energy in the speech band (250 Hz to 4 kHz) and the zero-crossing rate.
+ *
+ * Each class is a diagonal Gaussian over these features. The speech model is
+ * fixed relative to the noise floor, while the noise model keeps adapting to
+ * the frames classified as noise, so steady hum and hiss are learnt quickly.
+ * Like WebRTC, speech is held for a while after the last speech frame.
+ */
+
+#define FRAME_TIME_MS 10
+#define HANGOVER_FRAMES 20
+#define N_FEATURES 3
+#define MIN_VARIANCE 1e-4
+
+enum {
+  FEATURE_LEVEL,
+  FEATURE_SPEECH_RATIO,
+  FEATURE_CROSSINGS,
+};
+
+struct _MarsVad {
+  gint     rate;
+  gint     channels;
+  gsize    frame_size;
+
+  /* One-pole low-pass filters splitting the bands. */
+  gdouble  alpha[2];
+  gdouble  lowpass[2];
+  gdouble  previous;
+
+  gsize    n_frame_samples;
+  gdouble  energy;
+  gdouble  speech_energy;
+  guint    crossings;
+
+  gdouble  noise_mean[N_FEATURES];
+  gdouble  noise_variance[N_FEATURES];
+  guint    hangover;
+};
+
+static const gdouble SPEECH_MEAN[N_FEATURES] = { 20, 0.8, 0.08 };
+static const gdouble SPEECH_VARIANCE[N_FEATURES] = { 100, 0.02, 0.005 };
+
+
+MarsVad *
+mars_vad_new (void)
+{
+  MarsVad *self = g_new0 (MarsVad, 1);
+
+  self->noise_mean[FEATURE_LEVEL] = -70;
+  self->noise_variance[FEATURE_LEVEL] = 100;
+  self->noise_mean[FEATURE_SPEECH_RATIO] = 0.3;
+  self->noise_variance[FEATURE_SPEECH_RATIO] = 0.05;
+  self->noise_mean[FEATURE_CROSSINGS] = 0.3;
+  self->noise_variance[FEATURE_CROSSINGS] = 0.05;
+
+  mars_vad_set_format (self, 16000, 1);
+
+  return self;
+}
+
+
+void
+mars_vad_free (MarsVad *self)
+{
+  g_free (self);
+}
+
+
+static gdouble
+get_alpha (gint rate, gdouble cutoff)
+{
+  return 1 - exp (-2 * G_PI * MIN (cutoff, 0.45 * rate) / rate);
+}
+
+
+void
+mars_vad_set_format (MarsVad *self, gint rate, gint channels)
+{
+  self->rate = rate;
+  self->channels = MAX (1, channels);
+  self->frame_size = MAX (1, rate * FRAME_TIME_MS / 1000);
+
+  self->alpha[0] = get_alpha (rate, 250);
+  self->alpha[1] = get_alpha (rate, 4000);
+
+  self->n_frame_samples = 0;
+  self->energy = 0;
+  self->speech_energy = 0;
+  self->crossings = 0;
+}
+
+
+static gdouble
+log_likelihood (gdouble value, gdouble mean, gdouble variance)
+{
+  return -0.5 * log (2 * G_PI * variance) - (value - mean) * (value - mean) / (2 * variance);
+}
+
+
+static void
+adapt_noise (MarsVad *self, const gdouble *features)
+{
+  for (guint i = 0; i < N_FEATURES; i++) {
+    gdouble delta = features[i] - self->noise_mean[i];
+    gdouble rate = delta < 0 && i == FEATURE_LEVEL ? 0.2 : 0.05;
+
+    self->noise_mean[i] += rate * delta;
+    self->noise_variance[i] += rate * (delta * delta - self->noise_variance[i]);
+    self->noise_variance[i] = MAX (self->noise_variance[i], MIN_VARIANCE);
+  }
+}
+
+
+static gboolean
+classify_frame (MarsVad *self)
+{
+  gdouble features[N_FEATURES];
+  gdouble ratio = 0;
+  gdouble speech_mean;
+  gboolean speech;
+
+  features[FEATURE_LEVEL] = 10 * log10 (self->energy / self->n_frame_samples /
+                                        ((gdouble) G_MAXINT16 * G_MAXINT16) + 1e-12);
+  features[FEATURE_SPEECH_RATIO] = self->energy > 0 ? self->speech_energy / self->energy : 0;
+  features[FEATURE_CROSSINGS] = (gdouble) self->crossings / self->n_frame_samples;
+
+  for (guint i = 0; i < N_FEATURES; i++) {
+    speech_mean = SPEECH_MEAN[i];
+
+    if (i == FEATURE_LEVEL)
+      speech_mean += self->noise_mean[FEATURE_LEVEL];
+
+    ratio += log_likelihood (features[i], speech_mean, SPEECH_VARIANCE[i]) -
+             log_likelihood (features[i], self->noise_mean[i], self->noise_variance[i]);
+  }
+
+  speech = ratio > 0 && features[FEATURE_LEVEL] > self->noise_mean[FEATURE_LEVEL] + 6;
+
+  if (speech)
+    self->hangover = HANGOVER_FRAMES;
+  else
+    adapt_noise (self, features);
+
+  self->n_frame_samples = 0;
+  self->energy = 0;
+  self->speech_energy = 0;
+  self->crossings = 0;
+
+  if (self->hangover == 0)
+    return FALSE;
+
+  self->hangover--;
+  return TRUE;
+}
+
+
+/*
+ * Processes interleaved samples and returns whether any of the frames ending
+ * in them has speech. Without a complete frame, the last decision holds.
+ */
+gboolean
+mars_vad_process (MarsVad *self, const gint16 *samples, gsize n_samples)
+{
+  gboolean speech = self->hangover > 0;
+  gboolean framed = FALSE;
+
+  for (gsize i = 0; i + self->channels <= n_samples; i += self->channels) {
+    gdouble sample = 0;
+    gdouble band;
+
+    for (gint c = 0; c < self->channels; c++)
+      sample += samples[i + c];
+
+    sample /= self->channels;
+
+    self->lowpass[0] += self->alpha[0] * (sample - self->lowpass[0]);
+    self->lowpass[1] += self->alpha[1] * (sample - self->lowpass[1]);
+    band = self->lowpass[1] - self->lowpass[0];
+
+    self->energy += sample * sample;
+    self->speech_energy += band * band;
+    self->crossings += (sample >= 0) != (self->previous >= 0);
+    self->previous = sample;
+
+    if (++self->n_frame_samples < self->frame_size)
+      continue;
+
+    if (!framed)
+      speech = FALSE;
+
+    framed = TRUE;
+    speech |= classify_frame (self);
+  }
+
+  return speech;
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2024 Tether Operations Limited
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MarsVad MarsVad;
+
+MarsVad  *mars_vad_new (void);
+void      mars_vad_free (MarsVad *self);
+
+void      mars_vad_set_format (MarsVad *self, gint rate, gint channels);
+gboolean  mars_vad_process (MarsVad *self, const gint16 *samples, gsize n_samples);
+
+G_END_DECLS